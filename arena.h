@@ -0,0 +1,77 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "my_string.h"
+#include "utils.h"
+
+// Bump allocator for bytes living until end of command: `Arena_reset`
+// releases all of them at once, keeping newest (largest) block, so once
+// it has grown to fit typical command, commands don't malloc at all
+
+#define ARENA_BLOCK_MIN ((size_t) 4096)
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* prev;
+    size_t capacity;
+    size_t used;
+    char data[];
+} ArenaBlock_t;
+
+typedef struct {
+    ArenaBlock_t* block;
+} Arena_t;
+
+Arena_t Arena_new(void) {
+    Arena_t res = { NULL };
+    return res;
+}
+
+char* Arena_alloc(Arena_t* self, size_t size) {
+    ArenaBlock_t* block = self->block;
+    if (block == NULL || block->capacity - block->used < size) {
+        size_t capacity = block != NULL ? 2 * block->capacity : ARENA_BLOCK_MIN;
+        while (capacity < size)
+            capacity *= 2;
+        block = malloc(sizeof(ArenaBlock_t) + capacity);
+        ANZ(block, "Allocation failed");
+        block->prev = self->block;
+        block->capacity = capacity;
+        block->used = 0;
+        self->block = block;
+    }
+    char* res = block->data + block->used;
+    block->used += size;
+    return res;
+}
+
+// Copy of `slice` terminated with '\0'
+const char* Arena_cstr(Arena_t* self, StrSlice_t slice) {
+    char* res = Arena_alloc(self, slice.size + 1);
+    memcpy(res, slice.str, slice.size);
+    res[slice.size] = '\0';
+    return res;
+}
+
+void Arena_reset(Arena_t* self) {
+    if (self->block == NULL)
+        return;
+    for (ArenaBlock_t* block = self->block->prev; block != NULL;) {
+        ArenaBlock_t* prev = block->prev;
+        free(block);
+        block = prev;
+    }
+    self->block->prev = NULL;
+    self->block->used = 0;
+}
+
+void Arena_drop(Arena_t* self) {
+    Arena_reset(self);
+    free(self->block);
+    self->block = NULL;
+}
+
+#endif
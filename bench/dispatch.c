@@ -0,0 +1,89 @@
+// Cost of dispatch in batch mode: name of command is parsed off every
+// line of script and its handler is looked up. Lines of realistic script
+// (every command, plus some unknown words) are dispatched, but not run,
+// with old linear search over `handlers` and with `Command_lookup`.
+// First every name is checked to fit COMMAND_MAX_SIZE and to be
+// dispatched to its own handler (and unknown words to none).
+// Build and run from repository root:
+//   cc -O2 -pthread bench/dispatch.c -o dispatch-bench && ./dispatch-bench
+
+// for sync_file_range()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../handlers.h"
+#include "../script.h"
+
+#define BENCH_LINES ((size_t) 4 << 20)
+
+enum Command linear_lookup(StrSlice_t name) {
+    for (size_t i = 0; i < handlers_num; ++i)
+        if (strlen(handlers[i].pattern) == name.size && memcmp(handlers[i].pattern, name.str, name.size) == 0)
+            return i;
+    return CommandUnknown;
+}
+
+// Nanoseconds per line spent on parsing command name and finding handler
+double bench(Script_t* script, enum Command (*lookup)(StrSlice_t), size_t* checksum) {
+    Arena_t arena = Arena_new();
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < script->lines.size; ++i) {
+        ParseArgs_t it = ParseArgs_new(Script_line(script, i), &arena);
+        StrSlice_t word;
+        ParseArgs_next(&it, &word);
+        *checksum += lookup(word);
+    }
+    double elapsed = seconds_since(&start);
+    Arena_drop(&arena);
+    return elapsed * 1e9 / script->lines.size;
+}
+
+int main(void) {
+    static const char* const unknown[] = { "updat", "fnd", "printal", "expor", "x" };
+    size_t names_num = handlers_num + sizeof(unknown) / sizeof(unknown[0]);
+    for (size_t i = 0; i < handlers_num; ++i)
+        if (strlen(handlers[i].pattern) > COMMAND_MAX_SIZE) {
+            fprintf(stderr, "FAIL: `%s` is longer than COMMAND_MAX_SIZE\n", handlers[i].pattern);
+            return 1;
+        }
+    for (size_t i = 0; i < names_num; ++i) {
+        const char* name = i < handlers_num ? handlers[i].pattern : unknown[i - handlers_num];
+        enum Command expected = i < handlers_num ? (enum Command) i : CommandUnknown;
+        if (Command_lookup(StrSlice_from_raw(name)) != expected) {
+            fprintf(stderr, "FAIL: `%s` is dispatched to wrong handler\n", name);
+            return 1;
+        }
+    }
+
+    Script_t script = Script_new();
+    for (size_t i = 0; i < BENCH_LINES; ++i) {
+        const char* name = i % names_num < handlers_num ? handlers[i % names_num].pattern : unknown[i % names_num - handlers_num];
+        String_extend_with_str(&script.text, name);
+        String_extend_with_str(&script.text, " 1 \"some value\"\n");
+    }
+    Vector_resize(&script.lines, BENCH_LINES);
+    for (const char* pos = script.text.str; pos < script.text.str + script.text.size;) {
+        const char* eol = memchr(pos, '\n', script.text.str + script.text.size - pos);
+        StrSlice_t line = StrSlice_new(pos, eol - pos);
+        Vector_push(&script.lines, &line);
+        pos = eol + 1;
+    }
+
+    size_t linear_sum = 0;
+    size_t switch_sum = 0;
+    double linear = bench(&script, linear_lookup, &linear_sum);
+    double switched = bench(&script, Command_lookup, &switch_sum);
+    if (linear_sum != switch_sum) {
+        fputs("FAIL: lookups disagree\n", stderr);
+        return 1;
+    }
+    printf("%zu lines, %zu commands\n", script.lines.size, handlers_num);
+    printf("linear search: %.1f ns/line\n", linear);
+    printf("switch:        %.1f ns/line\n", switched);
+    Script_drop(&script);
+    return 0;
+}
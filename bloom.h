@@ -0,0 +1,168 @@
+#ifndef __BLOOM_H__
+#define __BLOOM_H__
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fs_fallible.h"
+#include "utils.h"
+
+// Blocked Bloom filter of values of single column, living in its own
+// memory-mapped file: page 0 is BloomMeta_t, then blocks of one cache
+// line follow. Value sets BLOOM_PROBES bits of single block picked by
+// its hash, so check of value reads one cache line. Values of deleted
+// rows are never taken out, filter is rebuilt (twice as large) from alive
+// rows once it's full. Filter saying "no" is always right
+
+#define BLOOM_META_SIZE ((size_t) 4096)
+#define BLOOM_BLOCK_SIZE ((size_t) 64)
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_SIZE * 8)
+// under 1% of false positives for full filter with 7 probes
+#define BLOOM_BITS_PER_KEY 12
+#define BLOOM_PROBES 7
+#define BLOOM_MIN_BLOCKS ((size_t) 64)
+
+typedef struct {
+    char magic[8];
+    uint64_t blocks;
+    // number of values put since filter was (re)built
+    uint64_t keys;
+    // number of rows in table when filter was closed
+    uint64_t rows_num;
+    // set by BloomFilter_close, cleared on open: filter of crashed
+    // session is never trusted
+    uint64_t clean;
+} BloomMeta_t;
+
+typedef struct {
+    int fd;
+    char* map;
+    size_t map_size;
+} BloomFilter_t;
+
+static const char BLOOM_MAGIC[8] = "09BLOOM";
+
+BloomMeta_t* BloomFilter_meta(const BloomFilter_t* self) {
+    return (BloomMeta_t*) self->map;
+}
+
+// Drops all values, making place for `keys` values before filter is full
+void BloomFilter_reset(BloomFilter_t* self, size_t keys) {
+    size_t blocks = (keys * BLOOM_BITS_PER_KEY + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS;
+    if (blocks < BLOOM_MIN_BLOCKS)
+        blocks = BLOOM_MIN_BLOCKS;
+    if (self->map != NULL)
+        munmap_(self->map, self->map_size);
+    size_t size = BLOOM_META_SIZE + blocks * BLOOM_BLOCK_SIZE;
+    ftruncate_(self->fd, 0);
+    ftruncate_(self->fd, size);
+    self->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
+    if (self->map == MAP_FAILED) { FATAL("mmap() failed"); }
+    self->map_size = size;
+    BloomMeta_t* meta = BloomFilter_meta(self);
+    memcpy(meta->magic, BLOOM_MAGIC, sizeof(BLOOM_MAGIC));
+    meta->blocks = blocks;
+}
+
+// Opens filter file at `path` (creating it if needed). Returns false if
+// filter is fresh (with place for `keys` values) and has to be filled
+// by caller: existing one is either not closed properly or was built for
+// another table state
+bool BloomFilter_open(BloomFilter_t* self, const char* path, size_t rows_num, size_t keys) {
+    self->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (self->fd == -1) { FATAL("Can't open Bloom filter file"); }
+    self->map = NULL;
+    self->map_size = 0;
+    struct stat st;
+    if (fstat(self->fd, &st)) { FATAL("fstat() != 0"); }
+    bool valid = false;
+    if ((size_t) st.st_size >= BLOOM_META_SIZE) {
+        self->map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
+        if (self->map == MAP_FAILED) { FATAL("mmap() failed"); }
+        self->map_size = st.st_size;
+        BloomMeta_t* meta = BloomFilter_meta(self);
+        valid =
+            memcmp(meta->magic, BLOOM_MAGIC, sizeof(BLOOM_MAGIC)) == 0
+            && meta->clean == 1
+            && meta->rows_num == rows_num
+            && meta->blocks > 0
+            && BLOOM_META_SIZE + meta->blocks * BLOOM_BLOCK_SIZE == self->map_size;
+    }
+    if (!valid)
+        BloomFilter_reset(self, 2 * keys);
+    BloomFilter_meta(self)->clean = 0;
+    msync(self->map, BLOOM_META_SIZE, MS_SYNC);
+    return valid;
+}
+
+void BloomFilter_close(BloomFilter_t* self, size_t rows_num) {
+    if (self->map == NULL)
+        return;
+    BloomMeta_t* meta = BloomFilter_meta(self);
+    meta->rows_num = rows_num;
+    meta->clean = 1;
+    msync(self->map, self->map_size, MS_SYNC);
+    munmap_(self->map, self->map_size);
+    self->map = NULL;
+    close(self->fd);
+}
+
+// Finalizer of MurmurHash3: bits of FNV-1a are poorly mixed, block and
+// probes need all of them to be random
+uint64_t bloom_mix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Block of value with mixed hash `mixed` (multiply-shift by its high
+// bits instead of modulo: number of blocks isn't power of two)
+uint64_t* BloomFilter_block(const BloomFilter_t* self, uint64_t mixed) {
+    uint64_t blocks = BloomFilter_meta(self)->blocks;
+    size_t block = (mixed >> 32) * blocks >> 32;
+    return (uint64_t*) (self->map + BLOOM_META_SIZE + block * BLOOM_BLOCK_SIZE);
+}
+
+// Probes are 9-bit pieces of hash mixed once again, so that they don't
+// depend on block
+void BloomFilter_put(BloomFilter_t* self, uint64_t hash) {
+    uint64_t mixed = bloom_mix(hash);
+    uint64_t* block = BloomFilter_block(self, mixed);
+    uint64_t probes = bloom_mix(mixed);
+    for (size_t i = 0; i < BLOOM_PROBES; ++i) {
+        size_t bit = probes >> (i * 9) & (BLOOM_BLOCK_BITS - 1);
+        block[bit / 64] |= (uint64_t) 1 << (bit % 64);
+    }
+    ++BloomFilter_meta(self)->keys;
+}
+
+// False if value with `hash` was never put
+bool BloomFilter_may_contain(const BloomFilter_t* self, uint64_t hash) {
+    uint64_t mixed = bloom_mix(hash);
+    const uint64_t* block = BloomFilter_block(self, mixed);
+    uint64_t probes = bloom_mix(mixed);
+    for (size_t i = 0; i < BLOOM_PROBES; ++i) {
+        size_t bit = probes >> (i * 9) & (BLOOM_BLOCK_BITS - 1);
+        if (!(block[bit / 64] >> (bit % 64) & 1))
+            return false;
+    }
+    return true;
+}
+
+// Filter holds as many values as it's sized for: false positive rate
+// would grow past designed one with more
+bool BloomFilter_full(const BloomFilter_t* self) {
+    const BloomMeta_t* meta = BloomFilter_meta(self);
+    return meta->keys * BLOOM_BITS_PER_KEY >= meta->blocks * BLOOM_BLOCK_BITS;
+}
+
+#endif
@@ -0,0 +1,338 @@
+#ifndef __BTREE_H__
+#define __BTREE_H__
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fs_fallible.h"
+#include "iterator.h"
+#include "utils.h"
+
+// B+tree over fixed-width keys, living in its own memory-mapped file.
+// Entry key is (field bytes, row index), so duplicates of field value
+// are ordered by row and every entry is unique.
+// Page 0 is BTreeMeta_t, every other page is a node:
+//   leaf:     BTreeNode_t, [key | row] * count; `next` is next leaf
+//   internal: BTreeNode_t, [key | row | child] * count; `next` is
+//             leftmost child, `child` holds entries >= its key
+// Removal doesn't merge nodes: separators stay valid bounds, and
+// iteration just passes through emptied leaves
+
+#define BTREE_PAGE_SIZE 4096
+#define BTREE_MAX_DEPTH 32
+
+typedef struct {
+    char magic[8];
+    uint64_t key_size;
+    uint64_t root;
+    // number of pages in use (including meta)
+    uint64_t pages;
+    // number of rows in table when tree was closed
+    uint64_t rows_num;
+    // set by BTree_close, cleared on open: tree of crashed
+    // session is never trusted
+    uint64_t clean;
+} BTreeMeta_t;
+
+typedef struct {
+    uint32_t leaf;
+    uint32_t count;
+    uint64_t next;
+} BTreeNode_t;
+
+typedef struct {
+    int fd;
+    char* map;
+    size_t map_size;
+    size_t key_size;
+} BTree_t;
+
+typedef struct {
+    const BTree_t* tree;
+    uint64_t page;
+    size_t pos;
+} BTreeIter_t;
+
+static const char BTREE_MAGIC[8] = "09BTREE";
+
+BTreeMeta_t* BTree_meta(const BTree_t* self) {
+    return (BTreeMeta_t*) self->map;
+}
+
+BTreeNode_t* BTree_node(const BTree_t* self, uint64_t page) {
+    return (BTreeNode_t*) (self->map + page * BTREE_PAGE_SIZE);
+}
+
+size_t BTree_entry_size(const BTree_t* self, bool leaf) {
+    return self->key_size + sizeof(uint64_t) * (leaf ? 1 : 2);
+}
+
+size_t BTree_node_capacity(const BTree_t* self, bool leaf) {
+    return (BTREE_PAGE_SIZE - sizeof(BTreeNode_t)) / BTree_entry_size(self, leaf);
+}
+
+char* BTree_entry(const BTree_t* self, BTreeNode_t* node, size_t i) {
+    return (char*) (node + 1) + i * BTree_entry_size(self, node->leaf);
+}
+
+uint64_t BTree_entry_row(const BTree_t* self, const char* entry) {
+    uint64_t res;
+    memcpy(&res, entry + self->key_size, sizeof(res));
+    return res;
+}
+
+uint64_t BTree_entry_child(const BTree_t* self, const char* entry) {
+    uint64_t res;
+    memcpy(&res, entry + self->key_size + sizeof(uint64_t), sizeof(res));
+    return res;
+}
+
+// Compares entry against (key, row)
+int BTree_cmp(const BTree_t* self, const char* entry, const char* key, uint64_t row) {
+    int res = memcmp(entry, key, self->key_size);
+    if (res != 0)
+        return res;
+    uint64_t entry_row = BTree_entry_row(self, entry);
+    return entry_row < row ? -1 : entry_row > row;
+}
+
+// Key must leave room for at least 4 entries per node
+bool BTree_key_size_ok(size_t key_size) {
+    return key_size > 0 && key_size + 2 * sizeof(uint64_t) <= (BTREE_PAGE_SIZE - sizeof(BTreeNode_t)) / 4;
+}
+
+void BTree_map(BTree_t* self, size_t size) {
+    if (self->map != NULL)
+        munmap_(self->map, self->map_size);
+    self->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
+    if (self->map == MAP_FAILED) { FATAL("mmap() failed"); }
+    self->map_size = size;
+}
+
+// Returns number of fresh zeroed page; may remap
+uint64_t BTree_alloc(BTree_t* self, bool leaf) {
+    uint64_t page = BTree_meta(self)->pages;
+    if ((page + 1) * BTREE_PAGE_SIZE > self->map_size) {
+        size_t size = self->map_size * 2;
+        ftruncate_(self->fd, size);
+        BTree_map(self, size);
+    }
+    ++BTree_meta(self)->pages;
+    BTreeNode_t* node = BTree_node(self, page);
+    memset(node, 0, BTREE_PAGE_SIZE);
+    node->leaf = leaf;
+    return page;
+}
+
+// Drops all entries, leaving single empty leaf
+void BTree_clear(BTree_t* self) {
+    ftruncate_(self->fd, 0);
+    ftruncate_(self->fd, 16 * BTREE_PAGE_SIZE);
+    BTree_map(self, 16 * BTREE_PAGE_SIZE);
+    BTreeMeta_t* meta = BTree_meta(self);
+    memcpy(meta->magic, BTREE_MAGIC, sizeof(BTREE_MAGIC));
+    meta->key_size = self->key_size;
+    meta->pages = 1;
+    meta->root = BTree_alloc(self, true);
+}
+
+// Opens tree file at `path` (creating it if needed). Returns false if
+// tree is fresh and has to be filled by caller: existing one is
+// either not closed properly or was built for another table state
+bool BTree_open(BTree_t* self, const char* path, size_t key_size, size_t rows_num) {
+    self->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (self->fd == -1) { FATAL("Can't open B-tree file"); }
+    self->map = NULL;
+    self->map_size = 0;
+    self->key_size = key_size;
+    struct stat st;
+    if (fstat(self->fd, &st)) { FATAL("fstat() != 0"); }
+    bool valid = false;
+    if ((size_t) st.st_size >= BTREE_PAGE_SIZE && st.st_size % BTREE_PAGE_SIZE == 0) {
+        BTree_map(self, st.st_size);
+        BTreeMeta_t* meta = BTree_meta(self);
+        valid =
+            memcmp(meta->magic, BTREE_MAGIC, sizeof(BTREE_MAGIC)) == 0
+            && meta->key_size == key_size
+            && meta->clean == 1
+            && meta->rows_num == rows_num
+            && meta->pages * BTREE_PAGE_SIZE <= self->map_size;
+    }
+    if (!valid)
+        BTree_clear(self);
+    BTree_meta(self)->clean = 0;
+    msync(self->map, BTREE_PAGE_SIZE, MS_SYNC);
+    return valid;
+}
+
+void BTree_close(BTree_t* self, size_t rows_num) {
+    if (self->map == NULL)
+        return;
+    BTreeMeta_t* meta = BTree_meta(self);
+    size_t used = meta->pages * BTREE_PAGE_SIZE;
+    meta->rows_num = rows_num;
+    meta->clean = 1;
+    msync(self->map, self->map_size, MS_SYNC);
+    munmap_(self->map, self->map_size);
+    self->map = NULL;
+    ftruncate_(self->fd, used);
+    close(self->fd);
+}
+
+// Index of child to descend into from internal `node` looking for
+// (key, row). With `strict` it is child of last separator < key,
+// otherwise of last separator <= key. Returns page number
+uint64_t BTree_descend(const BTree_t* self, BTreeNode_t* node, const char* key, uint64_t row, bool strict) {
+    size_t lo = 0, hi = node->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int cmp = BTree_cmp(self, BTree_entry(self, node, mid), key, row);
+        if (cmp < 0 || (cmp == 0 && !strict))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return node->next;
+    return BTree_entry_child(self, BTree_entry(self, node, lo - 1));
+}
+
+// Position of first entry >= (key, row) in `node`
+size_t BTree_node_lower_bound(const BTree_t* self, BTreeNode_t* node, const char* key, uint64_t row) {
+    size_t lo = 0, hi = node->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (BTree_cmp(self, BTree_entry(self, node, mid), key, row) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void BTree_insert(BTree_t* self, const char* key, uint64_t row) {
+    uint64_t path[BTREE_MAX_DEPTH];
+    size_t depth = 0;
+    uint64_t page = BTree_meta(self)->root;
+    while (!BTree_node(self, page)->leaf) {
+        if (depth == BTREE_MAX_DEPTH) { FATAL("B-tree is too deep"); }
+        path[depth++] = page;
+        page = BTree_descend(self, BTree_node(self, page), key, row, false);
+    }
+
+    // Entry to insert into current node: (key, row[, child])
+    char entry[BTREE_PAGE_SIZE];
+    memcpy(entry, key, self->key_size);
+    memcpy(entry + self->key_size, &row, sizeof(row));
+    for (;;) {
+        BTreeNode_t* node = BTree_node(self, page);
+        bool leaf = node->leaf;
+        size_t entry_size = BTree_entry_size(self, leaf);
+        size_t pos = BTree_node_lower_bound(self, node, entry, BTree_entry_row(self, entry));
+        if (node->count < BTree_node_capacity(self, leaf)) {
+            char* at = BTree_entry(self, node, pos);
+            memmove(at + entry_size, at, (node->count - pos) * entry_size);
+            memcpy(at, entry, entry_size);
+            ++node->count;
+            return;
+        }
+
+        // Split: gather count + 1 entries, left half stays in node
+        char all[BTREE_PAGE_SIZE + BTREE_PAGE_SIZE];
+        size_t count = node->count + 1;
+        memcpy(all, BTree_entry(self, node, 0), pos * entry_size);
+        memcpy(all + pos * entry_size, entry, entry_size);
+        memcpy(
+            all + (pos + 1) * entry_size,
+            BTree_entry(self, node, pos),
+            (node->count - pos) * entry_size
+        );
+        uint64_t right_page = BTree_alloc(self, leaf);
+        node = BTree_node(self, page);
+        BTreeNode_t* right = BTree_node(self, right_page);
+        size_t left_count = count / 2;
+        node->count = left_count;
+        memcpy(BTree_entry(self, node, 0), all, left_count * entry_size);
+        // Separator goes up: (first key of right, right page)
+        char* separator = all + left_count * entry_size;
+        if (leaf) {
+            right->count = count - left_count;
+            memcpy(BTree_entry(self, right, 0), separator, right->count * entry_size);
+            right->next = node->next;
+            node->next = right_page;
+        } else {
+            // separator's child becomes leftmost child of right node
+            right->count = count - left_count - 1;
+            right->next = BTree_entry_child(self, separator);
+            memcpy(BTree_entry(self, right, 0), separator + entry_size, right->count * entry_size);
+        }
+        memmove(entry, separator, self->key_size + sizeof(uint64_t));
+        memcpy(entry + self->key_size + sizeof(uint64_t), &right_page, sizeof(right_page));
+
+        if (depth == 0) {
+            uint64_t root_page = BTree_alloc(self, false);
+            BTreeNode_t* root = BTree_node(self, root_page);
+            root->next = page;
+            root->count = 1;
+            memcpy(BTree_entry(self, root, 0), entry, BTree_entry_size(self, false));
+            BTree_meta(self)->root = root_page;
+            return;
+        }
+        page = path[--depth];
+    }
+}
+
+// Removes exact entry (key, row) if it is present
+void BTree_remove(BTree_t* self, const char* key, uint64_t row) {
+    uint64_t page = BTree_meta(self)->root;
+    while (!BTree_node(self, page)->leaf)
+        page = BTree_descend(self, BTree_node(self, page), key, row, false);
+    BTreeNode_t* node = BTree_node(self, page);
+    size_t pos = BTree_node_lower_bound(self, node, key, row);
+    if (pos == node->count || BTree_cmp(self, BTree_entry(self, node, pos), key, row) != 0)
+        return;
+    size_t entry_size = BTree_entry_size(self, true);
+    char* at = BTree_entry(self, node, pos);
+    memmove(at, at + entry_size, (node->count - pos - 1) * entry_size);
+    --node->count;
+}
+
+// Iterator positioned at first entry which key's first `key_len` bytes
+// are >= `key` (so `key_len` < key size gives prefix search)
+BTreeIter_t BTree_lower_bound(const BTree_t* self, const char* key, size_t key_len) {
+    // key padded with zeroes and row 0 is less than every entry with
+    // that prefix, descending strictly gives leftmost candidate
+    char full[BTREE_PAGE_SIZE];
+    memset(full, 0, self->key_size);
+    memcpy(full, key, key_len);
+    uint64_t page = BTree_meta(self)->root;
+    while (!BTree_node(self, page)->leaf)
+        page = BTree_descend(self, BTree_node(self, page), full, 0, true);
+    BTreeIter_t res = { self, page, BTree_node_lower_bound(self, BTree_node(self, page), full, 0) };
+    return res;
+}
+
+IterRes BTreeIter_next(BTreeIter_t* self, const char** key, uint64_t* row) {
+    BTreeNode_t* node = BTree_node(self->tree, self->page);
+    while (self->pos >= node->count) {
+        if (node->next == 0)
+            return IterEnd;
+        self->page = node->next;
+        self->pos = 0;
+        node = BTree_node(self->tree, self->page);
+    }
+    const char* entry = BTree_entry(self->tree, node, self->pos++);
+    *key = entry;
+    *row = BTree_entry_row(self->tree, entry);
+    return IterOk;
+}
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef __COLUMN_STORE_H__
+#define __COLUMN_STORE_H__
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fs_fallible.h"
+#include "utils.h"
+
+// Column-major copy of single column, living in its own memory-mapped
+// file, so that scan with predicate on that column reads only its bytes.
+// Page 0 is ColumnStoreMeta_t, then blocks of COLUMN_STORE_BLOCK_ROWS
+// rows follow: bitmap of alive rows (one cache line), then field bytes
+// (padded, as in row) of every row. Values of deleted rows may be stale
+
+#define COLUMN_STORE_META_SIZE ((size_t) 4096)
+#define COLUMN_STORE_BITMAP_SIZE ((size_t) 64)
+#define COLUMN_STORE_BLOCK_ROWS (COLUMN_STORE_BITMAP_SIZE * 8)
+#define COLUMN_STORE_GROW_MIN ((size_t) 1 << 20)
+
+typedef struct {
+    char magic[8];
+    uint64_t width;
+    // number of rows in table when store was closed
+    uint64_t rows_num;
+    // set by ColumnStore_close, cleared on open: store of crashed
+    // session is never trusted
+    uint64_t clean;
+} ColumnStoreMeta_t;
+
+typedef struct {
+    int fd;
+    char* map;
+    size_t map_size;
+    size_t width;
+} ColumnStore_t;
+
+static const char COLUMN_STORE_MAGIC[8] = "09COLS";
+
+ColumnStoreMeta_t* ColumnStore_meta(const ColumnStore_t* self) {
+    return (ColumnStoreMeta_t*) self->map;
+}
+
+size_t ColumnStore_block_offset(const ColumnStore_t* self, size_t idx) {
+    return
+        COLUMN_STORE_META_SIZE
+        + idx / COLUMN_STORE_BLOCK_ROWS * (COLUMN_STORE_BITMAP_SIZE + COLUMN_STORE_BLOCK_ROWS * self->width);
+}
+
+size_t ColumnStore_value_offset(const ColumnStore_t* self, size_t idx) {
+    return
+        ColumnStore_block_offset(self, idx) + COLUMN_STORE_BITMAP_SIZE
+        + idx % COLUMN_STORE_BLOCK_ROWS * self->width;
+}
+
+// Field of row #idx, row must be in store
+const char* ColumnStore_value(const ColumnStore_t* self, size_t idx) {
+    return self->map + ColumnStore_value_offset(self, idx);
+}
+
+uint64_t* ColumnStore_alive_word(const ColumnStore_t* self, size_t idx) {
+    return
+        (uint64_t*) (self->map + ColumnStore_block_offset(self, idx))
+        + idx % COLUMN_STORE_BLOCK_ROWS / 64;
+}
+
+bool ColumnStore_alive(const ColumnStore_t* self, size_t idx) {
+    return *ColumnStore_alive_word(self, idx) >> (idx % 64) & 1;
+}
+
+// Whether row #idx has place in store
+bool ColumnStore_has(const ColumnStore_t* self, size_t idx) {
+    return ColumnStore_value_offset(self, idx) + self->width <= self->map_size;
+}
+
+void ColumnStore_map(ColumnStore_t* self, size_t size) {
+    if (self->map != NULL)
+        munmap_(self->map, self->map_size);
+    self->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
+    if (self->map == MAP_FAILED) { FATAL("mmap() failed"); }
+    self->map_size = size;
+}
+
+// Grows file geometrically, so that it has place for row #idx
+void ColumnStore_reserve(ColumnStore_t* self, size_t idx) {
+    if (ColumnStore_has(self, idx))
+        return;
+    size_t needed = ColumnStore_value_offset(self, idx) + self->width;
+    size_t size = self->map_size * 2;
+    if (size < self->map_size + COLUMN_STORE_GROW_MIN)
+        size = self->map_size + COLUMN_STORE_GROW_MIN;
+    if (size < needed)
+        size = needed;
+    ftruncate_(self->fd, size);
+    ColumnStore_map(self, size);
+}
+
+// Drops all rows
+void ColumnStore_clear(ColumnStore_t* self) {
+    ftruncate_(self->fd, 0);
+    ftruncate_(self->fd, COLUMN_STORE_META_SIZE);
+    ColumnStore_map(self, COLUMN_STORE_META_SIZE);
+    ColumnStoreMeta_t* meta = ColumnStore_meta(self);
+    memcpy(meta->magic, COLUMN_STORE_MAGIC, sizeof(COLUMN_STORE_MAGIC));
+    meta->width = self->width;
+}
+
+// Opens store file at `path` (creating it if needed). Returns false if
+// store is fresh and has to be filled by caller: existing one is
+// either not closed properly or was built for another table state
+bool ColumnStore_open(ColumnStore_t* self, const char* path, size_t width, size_t rows_num) {
+    self->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (self->fd == -1) { FATAL("Can't open column store file"); }
+    self->map = NULL;
+    self->map_size = 0;
+    self->width = width;
+    struct stat st;
+    if (fstat(self->fd, &st)) { FATAL("fstat() != 0"); }
+    bool valid = false;
+    if ((size_t) st.st_size >= COLUMN_STORE_META_SIZE) {
+        ColumnStore_map(self, st.st_size);
+        ColumnStoreMeta_t* meta = ColumnStore_meta(self);
+        valid =
+            memcmp(meta->magic, COLUMN_STORE_MAGIC, sizeof(COLUMN_STORE_MAGIC)) == 0
+            && meta->width == width
+            && meta->clean == 1
+            && meta->rows_num == rows_num
+            && (rows_num == 0 || ColumnStore_has(self, rows_num - 1));
+    }
+    if (!valid)
+        ColumnStore_clear(self);
+    ColumnStore_meta(self)->clean = 0;
+    msync(self->map, COLUMN_STORE_META_SIZE, MS_SYNC);
+    return valid;
+}
+
+void ColumnStore_close(ColumnStore_t* self, size_t rows_num) {
+    if (self->map == NULL)
+        return;
+    size_t used = COLUMN_STORE_META_SIZE;
+    if (rows_num > 0) {
+        // trailing deleted rows may have never been put
+        ColumnStore_reserve(self, rows_num - 1);
+        used = ColumnStore_value_offset(self, rows_num - 1) + self->width;
+    }
+    ColumnStoreMeta_t* meta = ColumnStore_meta(self);
+    meta->rows_num = rows_num;
+    meta->clean = 1;
+    msync(self->map, self->map_size, MS_SYNC);
+    munmap_(self->map, self->map_size);
+    self->map = NULL;
+    ftruncate_(self->fd, used);
+    close(self->fd);
+}
+
+// Stores field of alive row #idx
+void ColumnStore_put(ColumnStore_t* self, size_t idx, const char* field) {
+    ColumnStore_reserve(self, idx);
+    memcpy(self->map + ColumnStore_value_offset(self, idx), field, self->width);
+    *ColumnStore_alive_word(self, idx) |= (uint64_t) 1 << (idx % 64);
+}
+
+// Marks row #idx as deleted
+void ColumnStore_remove(ColumnStore_t* self, size_t idx) {
+    if (ColumnStore_has(self, idx))
+        *ColumnStore_alive_word(self, idx) &= ~((uint64_t) 1 << (idx % 64));
+}
+
+#endif
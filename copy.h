@@ -0,0 +1,132 @@
+#ifndef __COPY_H__
+#define __COPY_H__
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "database.h"
+#include "table_writer.h"
+#include "utils.h"
+
+typedef enum { ExportOk, ExportTooWide, ExportIOErr, ExportCrashed } ExportStatus_t;
+
+typedef enum { CopyOk, CopyCantOpen, CopySameTable, CopyColumnsMismatch, CopyOverflow, CopyDuplicate } CopyStatus_t;
+
+// Writes table into new file `path` in given format (converting rows if
+// it differs). Deleted rows are kept, so that indices stay the same
+ExportStatus_t Database_export(const Database_t* self, const char* path, Format_t format) {
+    if (format == FormatBinary)
+        for (size_t col_idx = 0; col_idx < self->col_num; ++col_idx)
+            if (self->columns[col_idx].size > UINT16_MAX)
+                return ExportTooWide;
+    Database_t layout = Database_layout(self->columns, self->col_num, format);
+    TableWriter_t writer;
+    if (!TableWriter_new(&writer, &layout, path, O_EXCL)) {
+        Database_drop(&layout);
+        return ExportIOErr;
+    }
+    StrSlice_t vals[self->col_num];
+    // rows are copied first: writer may rewrite them meanwhile
+    char line[self->row_size];
+    for (size_t idx = 0; idx < self->rows_num; ++idx) {
+        bool alive;
+        IterRes res = Database_copy_row(self, idx, line, &alive);
+        if (res == IterTotalErr) {
+            TableWriter_abort(&writer, path);
+            Database_drop(&layout);
+            return ExportCrashed;
+        }
+        if (res != IterOk)
+            alive = false;
+        Database_release_behind(self, idx);
+        if (format == self->format) {
+            TableWriter_push_raw(&writer, line, alive);
+            continue;
+        }
+        for (size_t col_idx = 0; col_idx < self->col_num; ++col_idx)
+            vals[col_idx] = Database_line_field(self, line, col_idx);
+        TableWriter_push(&writer, vals, alive);
+    }
+    TableWriter_finish(&writer);
+    fsync_parent(path);
+    Database_drop(&layout);
+    return ExportOk;
+}
+
+// Adds alive rows of table in file `path` (of any format, with the same
+// number of columns) to `self` as single batch: either all of them are
+// added or none. Joins batch of `self` if it's already started. Source
+// table is only read, see `Database_open_readonly`.
+// Reports number of added rows in `added`
+CopyStatus_t Database_copy(Database_t* self, const char* path, size_t* added) {
+    Database_t source = Database_open_readonly(path);
+    StrSlice_t vals[self->col_num];
+    // source may be written by another process: rows are copied first
+    char* line = NULL;
+    CopyStatus_t res = CopyCantOpen;
+    if (source.fd == -1)
+        goto wipeout;
+    // the same file may be named in many ways
+    struct stat self_st, source_st;
+    if (fstat(self->fd, &self_st) || fstat(source.fd, &source_st)) { FATAL("fstat() != 0"); }
+    res = CopySameTable;
+    if (self_st.st_dev == source_st.st_dev && self_st.st_ino == source_st.st_ino)
+        goto wipeout;
+    res = CopyColumnsMismatch;
+    if (source.col_num != self->col_num)
+        goto wipeout;
+    line = malloc(source.row_size);
+    ANZ(line, "Allocation failed");
+
+    bool own_batch = !self->batching;
+    size_t batch_rows = self->batch.size / self->row_size;
+    Database_begin(self);
+    res = CopyOk;
+    *added = 0;
+    size_t idx;
+    for (idx = 0; res == CopyOk && idx < source.rows_num; ++idx) {
+        // row being written by writer of source may be torn: it's
+        // skipped rather than reported as broken
+        memcpy(line, Database_row(&source, idx), source.row_size);
+        bool alive = Database_alive(&source, idx);
+        if (source.format == FormatText)
+            alive = line[0] == '+' && line[source.row_size - 1] == '\n';
+        if (!alive)
+            continue;
+        for (size_t col_idx = 0; col_idx < self->col_num; ++col_idx)
+            vals[col_idx] = Database_line_field(&source, line, col_idx);
+        size_t row_idx;
+        switch (Database_add(self, vals, &row_idx)) {
+            case AddOk:
+                ++*added;
+                break;
+            case AddFieldOverflow:
+                res = CopyOverflow;
+                break;
+            case AddDuplicate:
+                res = CopyDuplicate;
+        }
+    }
+    if (res != CopyOk) {
+        fprintf(
+            stderr, "ERROR: row #%zu of `%s` %s\n", idx - 1, path,
+            res == CopyOverflow ? "doesn't fit" : "duplicates value of unique column"
+        );
+        Database_rollback_to(self, batch_rows);
+        if (own_batch)
+            Database_rollback(self);
+    } else if (own_batch) {
+        Database_commit(self);
+    }
+
+    wipeout:
+    free(line);
+    Database_drop(&source);
+    return res;
+}
+
+#endif
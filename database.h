@@ -1,136 +1,543 @@
 #ifndef __DATABASE_H__
 #define __DATABASE_H__
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "bloom.h"
+#include "btree.h"
+#include "column_store.h"
+#include "free_list.h"
+#include "hash_index.h"
 #include "iterator.h"
 #include "fs_fallible.h"
 #include "my_string.h"
+#include "output.h"
+#include "page_cache.h"
+#include "scan.h"
 #include "str_view.h"
+#include "table_lock.h"
 #include "utils.h"
+#include "wal.h"
 
 typedef struct {
     // number of bytes to be allocated per field
     size_t size;
     // used for interactive operations
     const char* name;
+    // ColumnFlags, 0 if omitted
+    unsigned flags;
 } Column_t;
 
-typedef struct {
-    const Column_t* columns;
-    size_t col_num;
-    size_t row_size;
-    // RW buffer
-    FILE* buffer;
-} Database_t;
+enum ColumnFlags {
+    // maintain in-memory hash index (value -> rows) for `find`
+    ColumnHashIndex = 1 << 0,
+    // maintain B+tree in `<filename>.btree<col_idx>` for ordered
+    // `find --prefix` and `find --range`
+    ColumnOrderedIndex = 1 << 1,
+    // keep column-major copy of column in `<filename>.col<col_idx>`, so
+    // that scans with predicate on column read only its bytes
+    ColumnColumnar = 1 << 2,
+    // keep Bloom filter of values in `<filename>.bloom<col_idx>`, so
+    // that `find` of value which isn't there reads nothing else
+    ColumnBloom = 1 << 3,
+    // no two alive rows may have equal values in column: `add`,
+    // `update` and `resurrect` are refused otherwise. Needs
+    // ColumnHashIndex, which is probed
+    ColumnUnique = 1 << 4
+};
+
+// File is grown at least by this number of bytes at once, so that
+// sequence of `Database_add` doesn't remap file on every row
+#define DATABASE_GROW_MIN ((size_t) 1 << 20)
+
+// File starts with fixed-size header describing table, rows follow it
+// (so they stay page-aligned in mapping)
+#define DATABASE_HEADER_SIZE ((size_t) 4096)
+#define DATABASE_VERSION 1
+#define DATABASE_NAME_SIZE 48
+#define DATABASE_MAX_COLUMNS 63
+
+typedef enum {
+    // Row is `+`/`-` flag and fields padded with spaces, all followed by
+    // space, except for the last one followed by `\n`
+    FormatText,
+    // Rows go in blocks of DATABASE_BLOCK_ROWS, each block starts with
+    // bitmap of alive rows. Row is lengths of fields (uint16_t each)
+    // followed by fields padded with spaces; its size is rounded up to
+    // be cache-line-friendly
+    FormatBinary
+} Format_t;
+
+#define DATABASE_LINE_SIZE ((size_t) 64)
+// Bitmap of block takes exactly one cache line
+#define DATABASE_BLOCK_ROWS (DATABASE_LINE_SIZE * 8)
+// Rows bulk paths read through mapping between `Database_release`s
+#define DATABASE_RELEASE_ROWS (DATABASE_BLOCK_ROWS * 8)
 
 typedef struct {
-    Database_t* database;
-    size_t row_idx;
-} RowsIter_t;
+    // NUL-terminated
+    char name[DATABASE_NAME_SIZE];
+    uint64_t size;
+    uint32_t flags;
+    uint32_t reserved;
+} ColumnHeader_t;
 
 typedef struct {
-    Database_t* database;
-    String_t line;
-    size_t idx;
-    StrView_t* values;
-    bool alive;
-} Row_t;
-
-Row_t Row_new(size_t line_size, size_t values_num) {
-    StrView_t* values = calloc(values_num, sizeof(StrView_t));
-    ANZ(values, "Allocation failed");
-    Row_t res = {
-        NULL,
-        String_reserve(line_size),
-        0,
-        values,
-        false
-    };
+    char magic[8];
+    uint32_t version;
+    uint32_t col_num;
+    uint64_t row_size;
+    // Counters below are trusted only if `clean`: it is reset on open
+    // and set by proper close, so after crash table is rescanned.
+    // While table is open `rows_num` is number of rows synced for sure
+    uint64_t rows_num;
+    uint64_t alive_num;
+    // Top of free list (slot to be reused first), UINT64_MAX if empty;
+    // the rest of list is kept in `<filename>.free`
+    uint64_t free_head;
+    uint64_t free_num;
+    uint32_t clean;
+    // Format_t
+    uint32_t format;
+    ColumnHeader_t columns[DATABASE_MAX_COLUMNS];
+} DatabaseHeader_t;
+
+_Static_assert(sizeof(DatabaseHeader_t) == DATABASE_HEADER_SIZE, "header must fill its page");
+
+static const char DATABASE_MAGIC[8] = "09TABLE";
+
+// Rounds size of binary row up to power of 2 below cache line size and
+// to whole cache lines above it, so that rows don't straddle lines
+size_t binary_row_size(size_t bytes) {
+    if (bytes > DATABASE_LINE_SIZE)
+        return (bytes + DATABASE_LINE_SIZE - 1) / DATABASE_LINE_SIZE * DATABASE_LINE_SIZE;
+    size_t res = 1;
+    while (res < bytes)
+        res *= 2;
     return res;
 }
 
-void Row_commit(Row_t* self) {
-    // 1. Goto needed row
-    fflush_(self->database->buffer);
-    fseek_(
-        self->database->buffer,
-        self->idx * self->database->row_size,
-        SEEK_SET
-    );
-    // 2. Write contents of line in it
-    StrSlice_fput(String_borrow(&self->line), self->database->buffer);
+// Computes offsets of fields inside row (if `offsets` is not NULL),
+// returns size of row
+size_t DatabaseHeader_layout(const DatabaseHeader_t* self, size_t* offsets) {
+    size_t offset = self->format == FormatText ? 1 : self->col_num * sizeof(uint16_t);
+    for (size_t i = 0; i < self->col_num; ++i) {
+        if (offsets != NULL)
+            offsets[i] = offset;
+        offset += self->columns[i].size + (self->format == FormatText);
+    }
+    return self->format == FormatText ? offset : binary_row_size(offset);
+}
+
+// Fills header of empty table with given columns
+void DatabaseHeader_init(DatabaseHeader_t* self, const Column_t* columns, size_t col_num, Format_t format) {
+    memset(self, 0, sizeof(*self));
+    memcpy(self->magic, DATABASE_MAGIC, sizeof(DATABASE_MAGIC));
+    self->version = DATABASE_VERSION;
+    self->col_num = col_num;
+    self->format = format;
+    for (size_t i = 0; i < col_num; ++i) {
+        strncpy(self->columns[i].name, columns[i].name, DATABASE_NAME_SIZE - 1);
+        self->columns[i].size = columns[i].size;
+        self->columns[i].flags = columns[i].flags;
+    }
+    self->row_size = DatabaseHeader_layout(self, NULL);
+    self->free_head = UINT64_MAX;
 }
 
-void Row_drop(Row_t* self) {
-    String_drop(&self->line);
-    free(self->values);
+// Checks that header is written by this version and is consistent
+bool DatabaseHeader_valid(const DatabaseHeader_t* self) {
+    if (
+        memcmp(self->magic, DATABASE_MAGIC, sizeof(DATABASE_MAGIC)) != 0
+        || self->version != DATABASE_VERSION
+        || (self->format != FormatText && self->format != FormatBinary)
+        || self->col_num == 0 || self->col_num > DATABASE_MAX_COLUMNS
+    )
+        return false;
+    for (size_t i = 0; i < self->col_num; ++i)
+        if (
+            self->columns[i].size == 0
+            || (self->format == FormatBinary && self->columns[i].size > UINT16_MAX)
+            || self->columns[i].name[DATABASE_NAME_SIZE - 1] != '\0'
+        )
+            return false;
+    return DatabaseHeader_layout(self, NULL) == self->row_size;
 }
 
-RowsIter_t RowsIter_new(Database_t* database) {
-    fflush(database->buffer);
-    rewind(database->buffer);
-    // additional 1 for \0 (added automatically by getline)
-    RowsIter_t res = { database, 0 };
+typedef struct {
+    // Owned copy of columns table
+    Column_t* columns;
+    size_t col_num;
+    size_t row_size;
+    // Offset of each column's field inside row
+    size_t* offsets;
+    Format_t format;
+    // RW file descriptor, -1 if file couldn't be opened
+    int fd;
+    // Shared RW mapping of whole file (header included)
+    char* map;
+    // Number of mapped bytes (equal to size of file)
+    size_t map_size;
+    // Number of rows stored in file; everything in mapping past them
+    // is zero-filled reserve left by last growth
+    size_t rows_num;
+    // Number of rows which are not deleted
+    size_t alive_num;
+    // Owned copy of file name, sidecar files are named after it
+    char* filename;
+    // Deleted rows which `Database_add` may reuse
+    FreeList_t free_list;
+    // One per column, empty for columns without ColumnHashIndex.
+    // Contains alive rows only, rebuilt on open
+    HashIndex_t* hash_indexes;
+    // One per column, unmapped for columns without ColumnOrderedIndex
+    BTree_t* btrees;
+    // One per column, unmapped for columns without ColumnColumnar
+    ColumnStore_t* column_stores;
+    // One per column, unmapped for columns without ColumnBloom
+    BloomFilter_t* blooms;
+    // Log of in-place mutations, replayed on open after crash
+    Wal_t* wal;
+    // Coordination with other processes having table open: reader (not
+    // `lock.writer`) has no indexes, it scans rows published by writer
+    TableLock_t lock;
+    // Between `Database_begin` and `Database_commit` added rows are
+    // formatted into `batch` and written to file all at once
+    bool batching;
+    String_t batch;
+    // Rows of `batch` by values of their unique columns (hashed with
+    // index of column), as batch isn't in indexes until commit
+    HashIndex_t batch_unique;
+    // Number of worker threads for full scans (`print`, unindexed `find`)
+    size_t threads;
+    // Pages kept mapped for row lookups (`--cache-mb`), NULL if there's
+    // no limit on them
+    PageCache_t* cache;
+} Database_t;
+
+// Path of file kept next to the table: `<filename><ext>`. Must be freed
+char* Database_sidecar(const Database_t* self, const char* ext) {
+    size_t filename_size = strlen(self->filename);
+    size_t ext_size = strlen(ext);
+    char* res = malloc(filename_size + ext_size + 1);
+    ANZ(res, "Allocation failed");
+    memcpy(res, self->filename, filename_size);
+    memcpy(res + filename_size, ext, ext_size + 1);
     return res;
 }
 
-IterRes RowsIter_next(RowsIter_t* self, Row_t* row) {
-    ssize_t res;
-    for (;;) {
-        res = String_getline(&row->line, self->database->buffer);
-        if (res == EOF)
-            return IterEnd;
-        row->idx = self->row_idx++;
-        if (row->line.size != self->database->row_size) {
-            fprintf(
-                stderr,
-                "ERROR: size of read line (%zu) != expected size of row (%zu)\n\"",
-                row->line.size,
-                self->database->row_size
-            );
-            StrSlice_fput(String_borrow(&row->line), stderr);
-            fputs("\"\n", stderr);
-            FATAL("database broken");
-        }
-        if (row->line.str[0] == '+') {
-            row->alive = true;
-            break;
-        }
-        if (row->line.str[0] == '-') {
-            row->alive = false;
-            break;
-        }
+DatabaseHeader_t* Database_header(const Database_t* self) {
+    return (DatabaseHeader_t*) self->map;
+}
+
+size_t Database_block_size(const Database_t* self) {
+    return DATABASE_LINE_SIZE + DATABASE_BLOCK_ROWS * self->row_size;
+}
+
+// Position of block containing row #idx (of binary table) in file
+size_t Database_block_offset(const Database_t* self, size_t idx) {
+    return DATABASE_HEADER_SIZE + idx / DATABASE_BLOCK_ROWS * Database_block_size(self);
+}
+
+// Position of row #idx in file (rows are fixed-width)
+size_t Database_row_offset(const Database_t* self, size_t idx) {
+    if (self->format == FormatText)
+        return DATABASE_HEADER_SIZE + idx * self->row_size;
+    return
+        Database_block_offset(self, idx) + DATABASE_LINE_SIZE
+        + idx % DATABASE_BLOCK_ROWS * self->row_size;
+}
+
+// Size of file holding exactly `rows` rows
+size_t Database_end_offset(const Database_t* self, size_t rows) {
+    return rows == 0 ? DATABASE_HEADER_SIZE : Database_row_offset(self, rows - 1) + self->row_size;
+}
+
+// Number of whole rows fitting into file of `size` bytes
+size_t Database_rows_in(const Database_t* self, size_t size) {
+    size -= DATABASE_HEADER_SIZE;
+    if (self->format == FormatText)
+        return size / self->row_size;
+    size_t blocks = size / Database_block_size(self);
+    size_t rest = size % Database_block_size(self);
+    return
+        blocks * DATABASE_BLOCK_ROWS
+        + (rest > DATABASE_LINE_SIZE ? (rest - DATABASE_LINE_SIZE) / self->row_size : 0);
+}
+
+char* Database_row(const Database_t* self, size_t idx) {
+    return self->map + Database_row_offset(self, idx);
+}
+
+// Word of bitmap (of binary table) holding alive bit of row #idx
+uint64_t* Database_alive_word(const Database_t* self, size_t idx) {
+    return
+        (uint64_t*) (self->map + Database_block_offset(self, idx))
+        + idx % DATABASE_BLOCK_ROWS / 64;
+}
+
+bool Database_alive(const Database_t* self, size_t idx) {
+    if (self->format == FormatText)
+        return Database_row(self, idx)[0] == '+';
+    return *Database_alive_word(self, idx) >> (idx % 64) & 1;
+}
+
+// Row is marked as deleted (row with broken flag is neither alive nor dead)
+bool Database_dead(const Database_t* self, size_t idx) {
+    if (self->format == FormatText)
+        return Database_row(self, idx)[0] == '-';
+    return !Database_alive(self, idx);
+}
+
+void Database_set_alive(Database_t* self, size_t idx, bool alive) {
+    if (self->format == FormatText) {
+        Database_row(self, idx)[0] = alive ? '+' : '-';
+    } else if (alive) {
+        *Database_alive_word(self, idx) |= (uint64_t) 1 << (idx % 64);
+    } else {
+        *Database_alive_word(self, idx) &= ~((uint64_t) 1 << (idx % 64));
+    }
+}
+
+// Whether slot #idx holds whole row rather than zero-filled reserve
+// left by growth or row torn by crash. Told by bytes every row has: flag
+// (maybe wrong one, such row is only skipped), separators and `\n` of
+// text row, sizes and padding of binary one
+bool Database_slot_whole(const Database_t* self, size_t idx) {
+    const char* row = Database_row(self, idx);
+    if (self->format == FormatText) {
+        if (row[0] == '\0' || row[self->row_size - 1] != '\n')
+            return false;
+        for (size_t col_idx = 0; col_idx + 1 < self->col_num; ++col_idx)
+            if (row[self->offsets[col_idx] + self->columns[col_idx].size] != ' ')
+                return false;
+        return true;
+    }
+    for (size_t col_idx = 0; col_idx < self->col_num; ++col_idx) {
+        uint16_t size;
+        memcpy(&size, row + col_idx * sizeof(uint16_t), sizeof(size));
+        if (size > self->columns[col_idx].size)
+            return false;
+        for (size_t i = size; i < self->columns[col_idx].size; ++i)
+            if (row[self->offsets[col_idx] + i] != ' ')
+                return false;
+    }
+    return true;
+}
+
+// Number of rows in file of table not closed properly: rows up to
+// `rows_num` of header were synced, rows past it are taken while whole
+size_t Database_recover_rows(const Database_t* self) {
+    size_t rows_in = Database_rows_in(self, self->map_size);
+    size_t rows = Database_header(self)->rows_num;
+    if (rows > rows_in)
+        rows = rows_in;
+    while (rows < rows_in && Database_slot_whole(self, rows))
+        ++rows;
+    return rows;
+}
+
+void Database_map(Database_t* self, size_t size) {
+    if (self->map != NULL)
+        munmap_(self->map, self->map_size);
+    self->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
+    if (self->map == MAP_FAILED) { FATAL("mmap() failed"); }
+    self->map_size = size;
+    if (self->cache != NULL)
+        PageCache_attach(self->cache, self->map, size, self->fd);
+}
+
+// Hands `cache` (may be NULL) over to table, which uses it from now on
+void Database_set_cache(Database_t* self, PageCache_t* cache) {
+    self->cache = cache;
+    if (cache != NULL && self->map != NULL)
+        PageCache_attach(cache, self->map, self->map_size, self->fd);
+}
+
+// Tells cache (if any) that row #idx is being read (or written if
+// `dirty`), with its alive bit
+void Database_touch(const Database_t* self, size_t idx, bool dirty) {
+    if (self->cache == NULL)
+        return;
+    PageCache_touch(self->cache, Database_row_offset(self, idx), self->row_size, dirty);
+    if (self->format == FormatBinary)
+        PageCache_touch(self->cache, (char*) Database_alive_word(self, idx) - self->map, sizeof(uint64_t), dirty);
+}
+
+// Gives pages of rows [first, end) read or written past cache (if any)
+// back to it
+void Database_release(const Database_t* self, size_t first, size_t end) {
+    if (self->cache == NULL || first >= end)
+        return;
+    // with alive bits of binary rows
+    size_t offset = Database_row_offset(self, first);
+    if (self->format == FormatBinary)
+        offset = Database_block_offset(self, first);
+    PageCache_release(self->cache, offset, Database_end_offset(self, end) - offset);
+}
+
+// Gives pages of rows read by bulk path (which goes over rows in order)
+// back to cache once row #idx ends a run of DATABASE_RELEASE_ROWS rows or
+// the table, so that such path keeps that many rows mapped at most
+void Database_release_behind(const Database_t* self, size_t idx) {
+    if ((idx + 1) % DATABASE_RELEASE_ROWS == 0 || idx + 1 == self->rows_num)
+        Database_release(self, idx / DATABASE_RELEASE_ROWS * DATABASE_RELEASE_ROWS, idx + 1);
+}
+
+// Make sure there is space for at least `rows` rows in mapping.
+// Grows file geometrically so that appends are amortized O(1)
+void Database_reserve(Database_t* self, size_t rows) {
+    size_t needed = Database_end_offset(self, rows);
+    if (needed <= self->map_size)
+        return;
+    size_t size = self->map_size * 2;
+    if (size < self->map_size + DATABASE_GROW_MIN)
+        size = self->map_size + DATABASE_GROW_MIN;
+    if (size < needed)
+        size = needed;
+    ftruncate_(self->fd, size);
+    Database_map(self, size);
+}
+
+IterRes Database_check_line(const Database_t* self, size_t idx, const char* line, bool* alive);
+
+// Checks that row #idx is well-formed and reads its flag.
+// Broken row size is fatal; row with wrong flag is reported and
+// IterSingleErr is returned, so that iterators skip it
+IterRes Database_check_row(const Database_t* self, size_t idx, bool* alive) {
+    // binary rows have no flag nor `\n` to get wrong
+    if (self->format == FormatBinary) {
+        *alive = Database_alive(self, idx);
+        return IterOk;
+    }
+    return Database_check_line(self, idx, Database_row(self, idx), alive);
+}
+
+// `Database_read_row` past cache: for bulk paths, which give pages back
+// with `Database_release_behind` instead
+IterRes Database_copy_row(const Database_t* self, size_t idx, char* out, bool* alive) {
+    uint64_t seq;
+    do {
+        if (!TableLock_read_begin(&self->lock, &seq))
+            return IterTotalErr;
+        memcpy(out, Database_row(self, idx), self->row_size);
+        if (self->format == FormatBinary)
+            *alive = Database_alive(self, idx);
+    } while (TableLock_read_retry(&self->lock, seq));
+    if (self->format == FormatBinary)
+        return IterOk;
+    return Database_check_line(self, idx, out, alive);
+}
+
+// Copies row #idx into `out` (`row_size` bytes) and checks it as
+// `Database_check_row` does. Reader gets row as a whole even if writer
+// rewrites it meanwhile; IterTotalErr is returned if writer died doing
+// it (see `TableLock_crashed`)
+IterRes Database_read_row(const Database_t* self, size_t idx, char* out, bool* alive) {
+    Database_touch(self, idx, false);
+    return Database_copy_row(self, idx, out, alive);
+}
+
+// Text row #idx (or its copy) `line`, see `Database_check_row`
+IterRes Database_check_line(const Database_t* self, size_t idx, const char* line, bool* alive) {
+    if (line[self->row_size - 1] != '\n') {
         fprintf(
             stderr,
-            "ERROR: line starts with wrong character: '%c'\n",
-            row->line.str[0]
+            "ERROR: row #%zu is not terminated with \\n at expected size of row (%zu)\n\"",
+            idx,
+            self->row_size
         );
+        StrSlice_fput(StrSlice_new(line, self->row_size), stderr);
+        fputs("\"\n", stderr);
+        FATAL("database broken");
     }
-    size_t offset = 1;
-    for (size_t i = 0; i < self->database->col_num; ++i) {
-        size_t size = StrSlice_rstrip(
-            String_get_slice(
-                &row->line,
-                offset,
-                self->database->columns[i].size
-            ),
-            ' '
-        ).size;
-        row->values[i] = String_get_view(
-            &row->line,
-            offset,
-            size,
-            self->database->columns[i].size
-        );
-        offset += self->database->columns[i].size + 1;
+    if (line[0] == '+') {
+        *alive = true;
+        return IterOk;
+    }
+    if (line[0] == '-') {
+        *alive = false;
+        return IterOk;
     }
-    row->database = self->database;
+    fprintf(
+        stderr,
+        "ERROR: line starts with wrong character: '%c'\n",
+        line[0]
+    );
+    return IterSingleErr;
+}
+
+// Value of column #col_idx in row `line` (without padding)
+StrSlice_t Database_line_field(const Database_t* self, const char* line, size_t col_idx) {
+    StrSlice_t field = StrSlice_new(line + self->offsets[col_idx], self->columns[col_idx].size);
+    if (self->format == FormatText)
+        return StrSlice_rstrip(field, ' ');
+    uint16_t size;
+    memcpy(&size, line + col_idx * sizeof(uint16_t), sizeof(size));
+    field.size = size;
+    return field;
+}
+
+// Row as read from table: `line` and `values` point straight
+// into mapping, nothing is copied. Valid until next call to
+// `Database_add` (it may remap file)
+typedef struct {
+    const char* line;
+    size_t idx;
+    StrSlice_t* values;
+    bool alive;
+} RowView_t;
+
+// View keeping values in caller's `values` (of `col_num` slices), there is
+// nothing to drop
+RowView_t RowView_with(StrSlice_t* values) {
+    RowView_t res = { NULL, 0, values, false };
+    return res;
+}
+
+// Raw bytes of column #col_idx in row #idx (padded to column size)
+const char* Database_field_raw(const Database_t* self, size_t idx, size_t col_idx) {
+    return Database_row(self, idx) + self->offsets[col_idx];
+}
+
+// Value of column #col_idx in row #idx (without padding)
+StrSlice_t Database_field(const Database_t* self, size_t idx, size_t col_idx) {
+    return Database_line_field(self, Database_row(self, idx), col_idx);
+}
+
+// Fills `row` with view of row #idx. Row must be in bounds
+IterRes Database_view(const Database_t* self, size_t idx, RowView_t* row) {
+    row->idx = idx;
+    Database_touch(self, idx, false);
+    if (Database_check_row(self, idx, &row->alive) != IterOk)
+        return IterSingleErr;
+    row->line = Database_row(self, idx);
+    for (size_t i = 0; i < self->col_num; ++i)
+        row->values[i] = Database_line_field(self, row->line, i);
     return IterOk;
 }
 
-typedef enum { AddOk, AddFieldOverflow } AddStatus_t;
+void RowView_print(const RowView_t* self, size_t col_num, bool show_alive) {
+    printf("%zu", self->idx);
+    if (show_alive)
+        printf(" | %c", self->alive ? '+' : '-');
+    for (size_t i = 0; i < col_num; ++i) {
+        fputs(" | ", stdout);
+        StrSlice_fput(self->values[i], stdout);
+    }
+    putchar('\n');
+}
+
+typedef enum { AddOk, AddFieldOverflow, AddDuplicate } AddStatus_t;
 
 typedef enum {
     DeleteOk, DeleteAlready,
@@ -141,58 +548,777 @@ typedef enum {
 typedef enum {
     ResurrectOk, ResurrectAlready,
     ResurrectOutOfBounds, ResurrectWrongSymbol,
-    ResurrectIOErr
+    ResurrectDuplicate, ResurrectIOErr
 } ResurrectStatus_t;
 
+typedef enum { GetOk, GetOutOfBounds, GetWrongSymbol, GetCrashed } GetStatus_t;
+
+typedef enum {
+    UpdateOk, UpdateOutOfBounds, UpdateBadColumn,
+    UpdateDead, UpdateWrongSymbol, UpdateFieldOverflow,
+    UpdateDuplicate
+} UpdateStatus_t;
+
+// Rebuilds full Bloom filter of column #col_idx from alive rows, with
+// place for twice as many values (values of deleted rows are gone then)
+void Database_bloom_grow(Database_t* self, size_t col_idx) {
+    BloomFilter_t* bloom = &self->blooms[col_idx];
+    BloomFilter_reset(bloom, 2 * self->alive_num);
+    for (size_t idx = 0; idx < self->rows_num; ++idx)
+        if (Database_alive(self, idx))
+            BloomFilter_put(bloom, StrSlice_hash(Database_field(self, idx, col_idx)));
+    Database_release(self, 0, self->rows_num);
+}
+
+// Adds alive row #idx to (or removes from) indexes (and column store)
+// of column #col_idx selected by `flags`. Bloom filter keeps values of
+// removed rows
+void Database_index_field(Database_t* self, size_t idx, size_t col_idx, bool insert, unsigned flags) {
+    if ((flags & ColumnBloom) && insert) {
+        BloomFilter_t* bloom = &self->blooms[col_idx];
+        if (BloomFilter_full(bloom))
+            Database_bloom_grow(self, col_idx);
+        BloomFilter_put(bloom, StrSlice_hash(Database_field(self, idx, col_idx)));
+    }
+    if (flags & ColumnHashIndex) {
+        uint64_t hash = StrSlice_hash(Database_field(self, idx, col_idx));
+        if (insert)
+            HashIndex_insert(&self->hash_indexes[col_idx], hash, idx);
+        else
+            HashIndex_remove(&self->hash_indexes[col_idx], hash, idx);
+    }
+    if (flags & ColumnOrderedIndex) {
+        const char* key = Database_field_raw(self, idx, col_idx);
+        if (insert)
+            BTree_insert(&self->btrees[col_idx], key, idx);
+        else
+            BTree_remove(&self->btrees[col_idx], key, idx);
+    }
+    if (flags & ColumnColumnar) {
+        if (insert)
+            ColumnStore_put(&self->column_stores[col_idx], idx, Database_field_raw(self, idx, col_idx));
+        else
+            ColumnStore_remove(&self->column_stores[col_idx], idx);
+    }
+}
+
+// Adds alive row #idx to (or removes from) all indexes
+void Database_index_row(Database_t* self, size_t idx, bool insert) {
+    for (size_t col_idx = 0; col_idx < self->col_num; ++col_idx)
+        Database_index_field(self, idx, col_idx, insert, self->columns[col_idx].flags);
+}
+
+// Prepends header to table written before header was introduced (with
+// given columns): file is rewritten into `<filename>.convert`, which is
+// renamed over it. Header is left unclean, so table is rescanned on open.
+// Returns false if file can't be rewritten
+bool Database_convert(const char* filename, int fd, const Column_t* columns, size_t col_num) {
+    size_t path_size = strlen(filename) + 9;
+    char path[path_size];
+    snprintf(path, path_size, "%s.convert", filename);
+    int out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out == -1)
+        return false;
+    DatabaseHeader_t header;
+    DatabaseHeader_init(&header, columns, col_num, FormatText);
+    write_all(out, (const char*) &header, sizeof(header));
+    size_t buffer_size = DATABASE_GROW_MIN;
+    char* buffer = malloc(buffer_size);
+    ANZ(buffer, "Allocation failed");
+    for (off_t offset = 0;;) {
+        ssize_t res = pread(fd, buffer, buffer_size, offset);
+        if (res == -1) { FATAL("pread() failed"); }
+        if (res == 0)
+            break;
+        write_all(out, buffer, res);
+        offset += res;
+    }
+    free(buffer);
+    if (fsync(out)) { FATAL("fsync() != 0"); }
+    close(out);
+    if (rename(path, filename)) { FATAL("Can't rename converted table over old one"); }
+    fsync_parent(filename);
+    return true;
+}
+
+// Takes columns (with owned names), their offsets, row size and format
+// from header
+void Database_load_columns(Database_t* self, const DatabaseHeader_t* header) {
+    self->col_num = header->col_num;
+    self->columns = malloc(self->col_num * sizeof(Column_t));
+    ANZ(self->columns, "Allocation failed");
+    self->offsets = malloc(self->col_num * sizeof(size_t));
+    ANZ(self->offsets, "Allocation failed");
+    self->format = header->format;
+    self->row_size = DatabaseHeader_layout(header, self->offsets);
+    for (size_t i = 0; i < self->col_num; ++i) {
+        self->columns[i].size = header->columns[i].size;
+        self->columns[i].name = strdup(header->columns[i].name);
+        ANZ(self->columns[i].name, "Allocation failed");
+        self->columns[i].flags = header->columns[i].flags;
+    }
+}
+
+// Redoes mutation logged by session which wasn't closed properly
+void Database_redo(void* ctx, const WalRecord_t* record, const char* row) {
+    Database_t* self = ctx;
+    if (row != NULL) {
+        if (record->idx >= self->rows_num) {
+            Database_reserve(self, record->idx + 1);
+            self->rows_num = record->idx + 1;
+        }
+        memcpy(Database_row(self, record->idx), row, self->row_size);
+    } else if (record->idx >= self->rows_num) {
+        return;
+    }
+    Database_set_alive(self, record->idx, record->alive);
+}
+
+// Table not backed by file: only describes layout of rows (for writing
+// tables with other columns or format). Freed by `Database_drop`
+Database_t Database_layout(const Column_t* columns, size_t col_num, Format_t format) {
+    DatabaseHeader_t header;
+    DatabaseHeader_init(&header, columns, col_num, format);
+    Database_t res = { NULL };
+    res.fd = -1;
+    Database_load_columns(&res, &header);
+    return res;
+}
+
+// Releases what `Database_open` got before failing
+Database_t database_open_failed(Database_t res) {
+    if (res.map != NULL)
+        munmap_(res.map, res.map_size);
+    res.map = NULL;
+    if (res.fd != -1)
+        close(res.fd);
+    res.fd = -1;
+    TableLock_close(&res.lock);
+    return res;
+}
+
+// Opens table stored in `filename`, taking its columns from header.
+// `columns` (may be NULL) are used only for empty file, which gets
+// header with them, and for file without header (written by older
+// version), which is converted. Table is opened for writing if writer
+// lock is free (or is already taken in `lock`, which is then handed
+// over), read-only otherwise. `fd` of result is -1 on failure
+Database_t Database_open(const char* filename, const Column_t* columns, size_t col_num, const TableLock_t* lock) {
+    Database_t res = {
+        NULL, 0, 0, NULL, FormatText,
+        open(filename, O_RDWR), NULL, 0, 0, 0,
+        NULL, FreeList_new(), NULL, NULL, NULL, NULL, NULL, { .fd = -1 },
+        false, String_new(), HashIndex_new(), 1, NULL
+    };
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 1)
+        res.threads = cpus;
+    if (res.fd == -1)
+        return res;
+    if (lock != NULL) {
+        res.lock = *lock;
+    } else {
+        size_t lock_path_size = strlen(filename) + 6;
+        char lock_path[lock_path_size];
+        snprintf(lock_path, lock_path_size, "%s.lock", filename);
+        if (!TableLock_open(&res.lock, lock_path)) {
+            ERR("Can't open lock file of table");
+            return database_open_failed(res);
+        }
+    }
+    // Only writer may initialize or convert file
+    bool writer = res.lock.writer;
+    struct stat st;
+    if (fstat(res.fd, &st)) { FATAL("fstat() != 0"); }
+    if (st.st_size == 0 && columns != NULL && writer) {
+        ftruncate_(res.fd, DATABASE_HEADER_SIZE);
+        Database_map(&res, DATABASE_HEADER_SIZE);
+        DatabaseHeader_init(Database_header(&res), columns, col_num, FormatText);
+    } else {
+        char magic[sizeof(DATABASE_MAGIC)] = {0};
+        if (pread(res.fd, magic, sizeof(magic), 0) == -1) { FATAL("pread() failed"); }
+        if (memcmp(magic, DATABASE_MAGIC, sizeof(magic)) != 0 && st.st_size > 0 && columns != NULL && writer) {
+            fputs("WARN: table has no header (written by older version), converting it\n", stderr);
+            if (!Database_convert(filename, res.fd, columns, col_num)) {
+                ERR("Can't convert table");
+                return database_open_failed(res);
+            }
+            close(res.fd);
+            res.fd = open(filename, O_RDWR);
+            if (res.fd == -1)
+                return database_open_failed(res);
+            if (fstat(res.fd, &st)) { FATAL("fstat() != 0"); }
+        }
+        if ((size_t) st.st_size >= DATABASE_HEADER_SIZE)
+            Database_map(&res, st.st_size);
+    }
+    if (res.map == NULL || !DatabaseHeader_valid(Database_header(&res))) {
+        fputs("ERROR: file doesn't start with valid table header\n", stderr);
+        return database_open_failed(res);
+    }
+    res.filename = strdup(filename);
+    ANZ(res.filename, "Allocation failed");
+    DatabaseHeader_t* header = Database_header(&res);
+    Database_load_columns(&res, header);
+    res.hash_indexes = calloc(res.col_num, sizeof(HashIndex_t));
+    ANZ(res.hash_indexes, "Allocation failed");
+    res.btrees = calloc(res.col_num, sizeof(BTree_t));
+    ANZ(res.btrees, "Allocation failed");
+    res.column_stores = calloc(res.col_num, sizeof(ColumnStore_t));
+    ANZ(res.column_stores, "Allocation failed");
+    res.blooms = calloc(res.col_num, sizeof(BloomFilter_t));
+    ANZ(res.blooms, "Allocation failed");
+    if (!writer) {
+        // Counters in header are stale until writer closes table
+        res.rows_num = TableLock_rows(&res.lock);
+        res.alive_num = res.lock.page->alive_num;
+        if (res.rows_num > Database_rows_in(&res, res.map_size))
+            res.rows_num = Database_rows_in(&res, res.map_size);
+        return res;
+    }
+
+    size_t rows_space = res.map_size - DATABASE_HEADER_SIZE;
+    bool clean = header->clean && header->rows_num <= Database_rows_in(&res, res.map_size);
+    if (clean) {
+        res.rows_num = header->rows_num;
+        res.alive_num = header->alive_num;
+    } else {
+        // growth leaves zeroed reserve of any size: only bytes written
+        // past last whole row are worth a warning
+        size_t rest = res.format == FormatText ? rows_space % res.row_size : 0;
+        bool tail_written = false;
+        for (size_t i = res.map_size - rest; i < res.map_size; ++i)
+            tail_written |= res.map[i] != '\0';
+        if (tail_written)
+            fprintf(
+                stderr,
+                "WARN: size of rows (%zu) is not multiple of row size (%zu), last %zu bytes ignored\n",
+                rows_space, res.row_size, rest
+            );
+        // file still has zeroed reserve in the end, and maybe part of
+        // batch which wasn't committed
+        res.rows_num = Database_recover_rows(&res);
+        if (res.map_size > Database_end_offset(&res, res.rows_num)) {
+            // so that rows added later don't get alive bits of cut ones
+            if (res.format == FormatBinary)
+                for (size_t idx = res.rows_num; idx % DATABASE_BLOCK_ROWS != 0; ++idx)
+                    Database_set_alive(&res, idx, false);
+            ftruncate_(res.fd, Database_end_offset(&res, res.rows_num));
+            Database_map(&res, Database_end_offset(&res, res.rows_num));
+            header = Database_header(&res);
+        }
+    }
+    char* wal_path = Database_sidecar(&res, ".wal");
+    // readers of crashed writer may still be scanning
+    TableLock_write_begin(&res.lock);
+    size_t replayed = Wal_replay(wal_path, res.row_size, Database_redo, &res);
+    TableLock_write_end(&res.lock);
+    if (replayed > 0) {
+        fprintf(stderr, "WARN: table was not closed properly, %zu logged changes replayed\n", replayed);
+        // counters and free list are recounted below
+        clean = false;
+        if (msync(res.map, res.map_size, MS_SYNC)) { FATAL("msync() != 0"); }
+    }
+    res.wal = Wal_open(wal_path, res.fd, res.row_size);
+    free(wal_path);
+    // Until proper close counters in header are stale, except for
+    // `rows_num` moved by `Database_commit`
+    header->rows_num = res.rows_num;
+    header->clean = 0;
+    if (msync(res.map, DATABASE_HEADER_SIZE, MS_SYNC)) { FATAL("msync() != 0"); }
+
+    char* free_path = Database_sidecar(&res, ".free");
+    bool free_loaded = FreeList_load(&res.free_list, free_path, res.rows_num);
+    if (!clean || res.free_list.size != header->free_num) {
+        res.free_list.size = 0;
+        free_loaded = false;
+    }
+    free(free_path);
+    if (!clean) {
+        res.alive_num = 0;
+        for (size_t idx = res.rows_num; idx-- > 0;) {
+            if (Database_dead(&res, idx))
+                FreeList_push(&res.free_list, idx);
+            res.alive_num += Database_alive(&res, idx);
+        }
+    } else if (!free_loaded && header->free_num > 0) {
+        for (size_t idx = res.rows_num; idx-- > 0;)
+            if (Database_dead(&res, idx))
+                FreeList_push(&res.free_list, idx);
+    }
+
+    // Hash indexes are always rebuilt, B-trees, column stores and Bloom
+    // filters only if stale
+    unsigned rebuild[res.col_num];
+    for (size_t col_idx = 0; col_idx < res.col_num; ++col_idx) {
+        rebuild[col_idx] = res.columns[col_idx].flags & ColumnHashIndex;
+        if (res.columns[col_idx].flags & ColumnColumnar) {
+            char ext[32];
+            snprintf(ext, sizeof(ext), ".col%zu", col_idx);
+            char* store_path = Database_sidecar(&res, ext);
+            if (!ColumnStore_open(&res.column_stores[col_idx], store_path, res.columns[col_idx].size, res.rows_num))
+                rebuild[col_idx] |= ColumnColumnar;
+            free(store_path);
+        }
+        if (res.columns[col_idx].flags & ColumnBloom) {
+            char ext[32];
+            snprintf(ext, sizeof(ext), ".bloom%zu", col_idx);
+            char* bloom_path = Database_sidecar(&res, ext);
+            if (!BloomFilter_open(&res.blooms[col_idx], bloom_path, res.rows_num, res.alive_num))
+                rebuild[col_idx] |= ColumnBloom;
+            free(bloom_path);
+        }
+        if (!(res.columns[col_idx].flags & ColumnOrderedIndex))
+            continue;
+        if (!BTree_key_size_ok(res.columns[col_idx].size)) {
+            FATAL("column is too wide for ColumnOrderedIndex");
+        }
+        char ext[32];
+        snprintf(ext, sizeof(ext), ".btree%zu", col_idx);
+        char* btree_path = Database_sidecar(&res, ext);
+        if (!BTree_open(&res.btrees[col_idx], btree_path, res.columns[col_idx].size, res.rows_num))
+            rebuild[col_idx] |= ColumnOrderedIndex;
+        free(btree_path);
+    }
+    for (size_t idx = 0; idx < res.rows_num; ++idx)
+        if (Database_alive(&res, idx))
+            for (size_t col_idx = 0; col_idx < res.col_num; ++col_idx)
+                if (rebuild[col_idx])
+                    Database_index_field(&res, idx, col_idx, true, rebuild[col_idx]);
+    TableLock_publish(&res.lock, res.rows_num, res.alive_num);
+    return res;
+}
+
 Database_t Database_new(const char* filename, const Column_t* columns, size_t col_num) {
-    size_t row_size = 1;
-    for (size_t i = 0; i < col_num; ++i)
-        row_size += columns[i].size + 1;
-    Database_t res = { columns, col_num, row_size, fopen(filename, "r+b") };
+    return Database_open(filename, columns, col_num, NULL);
+}
+
+// Opens table stored in `filename` only to read its rows, as they are in
+// file: neither lock nor derived files are touched (nor created), so
+// table isn't changed and its writer (if any) isn't waited for. Rows of
+// table not closed properly are counted as after crash. Has no indexes,
+// freed by `Database_drop`. `fd` of result is -1 on failure
+Database_t Database_open_readonly(const char* filename) {
+    Database_t res = { NULL };
+    res.fd = open(filename, O_RDONLY);
+    res.lock.fd = -1;
+    res.threads = 1;
+    if (res.fd == -1)
+        return res;
+    struct stat st;
+    if (fstat(res.fd, &st)) { FATAL("fstat() != 0"); }
+    if ((size_t) st.st_size >= DATABASE_HEADER_SIZE) {
+        res.map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, res.fd, 0);
+        if (res.map == MAP_FAILED) { FATAL("mmap() failed"); }
+        res.map_size = st.st_size;
+    }
+    if (res.map == NULL || !DatabaseHeader_valid(Database_header(&res))) {
+        fputs("ERROR: file doesn't start with valid table header\n", stderr);
+        return database_open_failed(res);
+    }
+    res.filename = strdup(filename);
+    ANZ(res.filename, "Allocation failed");
+    const DatabaseHeader_t* header = Database_header(&res);
+    Database_load_columns(&res, header);
+    size_t rows_in = Database_rows_in(&res, res.map_size);
+    if (header->clean && header->rows_num <= rows_in) {
+        res.rows_num = header->rows_num;
+        res.alive_num = header->alive_num;
+        return res;
+    }
+    res.rows_num = Database_recover_rows(&res);
+    for (size_t idx = 0; idx < res.rows_num; ++idx)
+        res.alive_num += Database_alive(&res, idx);
     return res;
 }
 
 void Database_drop(Database_t* self) {
-    if (self->buffer != NULL)
-        fclose(self->buffer);
+    PageCache_drop(self->cache);
+    self->cache = NULL;
+    for (size_t i = 0; i < self->col_num; ++i)
+        free((char*) self->columns[i].name);
+    free(self->offsets);
+    free(self->columns);
+    if (self->fd == -1)
+        return;
+    if (!self->lock.writer) {
+        // reader has nothing to save
+        free(self->hash_indexes);
+        free(self->btrees);
+        free(self->column_stores);
+        free(self->blooms);
+        String_drop(&self->batch);
+        HashIndex_drop(&self->batch_unique);
+        munmap_(self->map, self->map_size);
+        close(self->fd);
+        TableLock_close(&self->lock);
+        free(self->filename);
+        return;
+    }
+    Wal_close(self->wal);
+    if (self->batch.size != 0)
+        fprintf(
+            stderr,
+            "WARN: uncommitted batch of %zu rows is discarded\n",
+            self->batch.size / self->row_size
+        );
+    String_drop(&self->batch);
+    HashIndex_drop(&self->batch_unique);
+    // Leave only slots that are still free
+    size_t free_num = 0;
+    for (size_t i = 0; i < self->free_list.size; ++i) {
+        size_t slot = self->free_list.slots[i];
+        if (slot < self->rows_num && Database_dead(self, slot))
+            self->free_list.slots[free_num++] = slot;
+    }
+    self->free_list.size = free_num;
+    char* free_path = Database_sidecar(self, ".free");
+    FreeList_save(&self->free_list, free_path, self->rows_num);
+    free(free_path);
+    DatabaseHeader_t* header = Database_header(self);
+    header->rows_num = self->rows_num;
+    header->alive_num = self->alive_num;
+    header->free_num = free_num;
+    header->free_head = free_num > 0 ? self->free_list.slots[free_num - 1] : UINT64_MAX;
+    FreeList_drop(&self->free_list);
+    for (size_t col_idx = 0; col_idx < self->col_num; ++col_idx) {
+        HashIndex_drop(&self->hash_indexes[col_idx]);
+        BTree_close(&self->btrees[col_idx], self->rows_num);
+        ColumnStore_close(&self->column_stores[col_idx], self->rows_num);
+        BloomFilter_close(&self->blooms[col_idx], self->rows_num);
+    }
+    free(self->hash_indexes);
+    free(self->btrees);
+    free(self->column_stores);
+    free(self->blooms);
+    // Rows must be on disk before header says they match counters
+    if (msync(self->map, self->map_size, MS_SYNC)) { FATAL("msync() != 0"); }
+    header->clean = 1;
+    if (msync(self->map, DATABASE_HEADER_SIZE, MS_SYNC)) { FATAL("msync() != 0"); }
+    // Table holds every logged change now
+    Wal_remove(self->wal);
+    munmap_(self->map, self->map_size);
+    // cut off reserve left by growth
+    if (self->map_size != Database_end_offset(self, self->rows_num))
+        ftruncate_(self->fd, Database_end_offset(self, self->rows_num));
+    close(self->fd);
+    TableLock_close(&self->lock);
+    free(self->filename);
+}
+
+// Removes files derived from table (free list, B-trees, column stores,
+// Bloom filters), so that they're rebuilt on next open: they describe
+// old row layout
+void Database_remove_sidecars(const char* filename, size_t col_num) {
+    size_t size = strlen(filename) + 32;
+    char path[size];
+    snprintf(path, size, "%s.free", filename);
+    remove(path);
+    for (size_t col_idx = 0; col_idx < col_num; ++col_idx) {
+        snprintf(path, size, "%s.btree%zu", filename, col_idx);
+        remove(path);
+        snprintf(path, size, "%s.col%zu", filename, col_idx);
+        remove(path);
+        snprintf(path, size, "%s.bloom%zu", filename, col_idx);
+        remove(path);
+    }
+}
+
+// Closes table and opens it again, handing `lock` (may be NULL) over to
+// `Database_open`. With `replaced` derived files are dropped (and
+// rebuilt), as they describe old file. `self` must not be batching
+void Database_reload(Database_t* self, const TableLock_t* lock, bool replaced) {
+    char* filename = strdup(self->filename);
+    ANZ(filename, "Allocation failed");
+    size_t col_num = self->col_num;
+    size_t threads = self->threads;
+    PageCache_t* cache = self->cache;
+    // it's handed over to reopened table, not dropped
+    self->cache = NULL;
+    TableLock_t kept;
+    if (lock != NULL) {
+        kept = *lock;
+        // so that drop doesn't release it
+        self->lock.fd = -1;
+    }
+    Database_drop(self);
+    if (replaced)
+        Database_remove_sidecars(filename, col_num);
+    *self = Database_open(filename, NULL, 0, lock != NULL ? &kept : NULL);
+    if (self->fd == -1) { FATAL("Can't reopen table"); }
+    self->threads = threads;
+    Database_set_cache(self, cache);
+    free(filename);
+}
+
+// Reopens table after its file was replaced (by `vacuum`, `migrate`);
+// columns are taken from new header. Derived files are dropped and
+// rebuilt, readers are told to reopen it too. Writer lock is kept
+void Database_reopen(Database_t* self) {
+    // before new counters are published, see `Database_refresh`
+    TableLock_replaced(&self->lock);
+    TableLock_t lock = self->lock;
+    Database_reload(self, &lock, true);
+}
+
+bool Database_writable(Database_t* self);
+
+// Catches reader up with writer: takes rows published by it, reopening
+// table if its file was replaced, taking it over if writer died in the
+// middle of rewrite. Nothing to do for writer
+void Database_refresh(Database_t* self) {
+    if (self->fd == -1 || self->lock.writer)
+        return;
+    // rows it was rewriting can't be read until table is recovered
+    if (TableLock_crashed(&self->lock)) {
+        Database_writable(self);
+        return;
+    }
+    size_t rows_num = TableLock_rows(&self->lock);
+    // checked after counter, as writer replaces file before publishing
+    if (TableLock_stale(&self->lock)) {
+        Database_reload(self, NULL, false);
+        return;
+    }
+    if (Database_end_offset(self, rows_num) > self->map_size) {
+        struct stat st;
+        if (fstat(self->fd, &st)) { FATAL("fstat() != 0"); }
+        Database_map(self, st.st_size);
+        if (rows_num > Database_rows_in(self, self->map_size))
+            rows_num = Database_rows_in(self, self->map_size);
+    }
+    self->rows_num = rows_num;
+    self->alive_num = __atomic_load_n(&self->lock.page->alive_num, __ATOMIC_RELAXED);
+}
+
+// Makes sure this process may change table: reader becomes writer if
+// writer has gone. Returns false if another process writes table
+bool Database_writable(Database_t* self) {
+    if (self->lock.writer)
+        return true;
+    TableLock_t lock = self->lock;
+    if (!TableLock_take(&lock))
+        return false;
+    // as writer: table is recovered if previous writer crashed
+    Database_reload(self, &lock, false);
+    return true;
+}
+
+// Tells readers about rows and alive rows after change
+void Database_publish(Database_t* self) {
+    TableLock_publish(&self->lock, self->rows_num, self->alive_num);
+}
+
+typedef enum { CreateOk, CreateExists, CreateBadColumns, CreateIOErr } CreateStatus_t;
+
+// Creates file `filename` holding empty table with given columns
+CreateStatus_t Database_create(const char* filename, const Column_t* columns, size_t col_num, Format_t format) {
+    if (col_num == 0 || col_num > DATABASE_MAX_COLUMNS)
+        return CreateBadColumns;
+    for (size_t i = 0; i < col_num; ++i)
+        if (
+            strlen(columns[i].name) >= DATABASE_NAME_SIZE
+            || ((columns[i].flags & ColumnOrderedIndex) && !BTree_key_size_ok(columns[i].size))
+            || ((columns[i].flags & ColumnUnique) && !(columns[i].flags & ColumnHashIndex))
+        )
+            return CreateBadColumns;
+    DatabaseHeader_t header;
+    DatabaseHeader_init(&header, columns, col_num, format);
+    header.clean = 1;
+    if (!DatabaseHeader_valid(&header))
+        return CreateBadColumns;
+    int fd = open(filename, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd == -1)
+        return errno == EEXIST ? CreateExists : CreateIOErr;
+    write_all(fd, (const char*) &header, sizeof(header));
+    if (fsync(fd)) { FATAL("fsync() != 0"); }
+    close(fd);
+    fsync_parent(filename);
+    return CreateOk;
 }
 
 void Database_overview(Database_t* self) {
     puts("Database columns:");
     for (size_t i = 0; i < self->col_num; ++i)
         printf("%zu: %s (%zu)\n", i, self->columns[i].name, self->columns[i].size);
+    printf("Rows: %zu (%zu alive)\n", self->rows_num, self->alive_num);
     putchar('\n');
 }
 
-void Database_print(Database_t* self, bool filter_dead) {
-    RowsIter_t it = RowsIter_new(self);
-    Row_t row = Row_new(self->row_size, self->col_num);
-    bool die = false;
-    for (; !die;) {
-        switch (RowsIter_next(&it, &row)) {
-            case IterOk:
-                if (filter_dead && !row.alive)
-                    break;
-                printf("%zu", row.idx);
-                if (!filter_dead)
-                    printf(" | %c", row.alive ? '+' : '-');
-                // StrSlice_fput(String_borrow(&row.line), stdout);
-                for (size_t i = 0; i < self->col_num; ++i) {
-                    fputs(" | ", stdout);
-                    StrSlice_fput(row.values[i], stdout);
-                }
-                putchar('\n');
-                break;
-            case IterSingleErr:
-                // unreachable
-            default:
-                die = true;
+// Which rows `Database_print` shows and how
+typedef struct {
+    OutputFormat_t format;
+    // index of first row to show
+    size_t offset;
+    // most rows to show
+    size_t limit;
+} PrintOptions_t;
+
+static const PrintOptions_t PRINT_DEFAULTS = { OutputPipe, 0, SIZE_MAX };
+
+size_t Database_scan_rows(Database_t* self, const ScanPred_t* pred, bool filter_dead, const PrintOptions_t* options);
+
+void Database_print(Database_t* self, bool filter_dead, const PrintOptions_t* options) {
+    const char* names[self->col_num];
+    for (size_t i = 0; i < self->col_num; ++i)
+        names[i] = self->columns[i].name;
+    String_t header = String_new();
+    Output_header(&header, options->format, names, self->col_num, !filter_dead);
+    StrSlice_t part = String_borrow(&header);
+    Output_write(&part, header.size != 0);
+    String_drop(&header);
+    Database_scan_rows(self, NULL, filter_dead, options);
+}
+
+// Builds whole record of alive row with given values (which must fit)
+// in `out`: one memset for padding and separators, then one memcpy per
+// field. Both are vectorized by libc, so there's no byte-by-byte work.
+// Alive bit of binary row lives in bitmap, it's set by caller
+void Database_format_row(const Database_t* self, const StrSlice_t* vals, char* out) {
+    if (self->format == FormatBinary) {
+        memset(out, ' ', self->row_size);
+        for (size_t col_idx = 0; col_idx < self->col_num; ++col_idx) {
+            uint16_t size = vals[col_idx].size;
+            memcpy(out + col_idx * sizeof(uint16_t), &size, sizeof(size));
+            memcpy(out + self->offsets[col_idx], vals[col_idx].str, vals[col_idx].size);
         }
+        return;
+    }
+    memset(out, ' ', self->row_size - 1);
+    out[0] = '+';
+    for (size_t col_idx = 0; col_idx < self->col_num; ++col_idx)
+        memcpy(out + self->offsets[col_idx], vals[col_idx].str, vals[col_idx].size);
+    out[self->row_size - 1] = '\n';
+}
+
+void Database_begin(Database_t* self) {
+    self->batching = true;
+}
+
+// Hash under which batched row is in `batch_unique`: equal values of
+// different columns shouldn't collide
+uint64_t Database_batch_hash(StrSlice_t value, size_t col_idx) {
+    return StrSlice_hash(value) ^ (col_idx + 1) * 0x9e3779b97f4a7c15ULL;
+}
+
+// Adds row #pos of batch to (or removes from) `batch_unique`
+void Database_index_batched(Database_t* self, size_t pos, bool insert) {
+    const char* line = self->batch.str + pos * self->row_size;
+    for (size_t col_idx = 0; col_idx < self->col_num; ++col_idx) {
+        if (!(self->columns[col_idx].flags & ColumnUnique))
+            continue;
+        uint64_t hash = Database_batch_hash(Database_line_field(self, line, col_idx), col_idx);
+        if (insert)
+            HashIndex_insert(&self->batch_unique, hash, pos);
+        else
+            HashIndex_remove(&self->batch_unique, hash, pos);
     }
-    Row_drop(&row);
+}
+
+// Whether alive row other than #except or row of batch has `value` in
+// unique column #col_idx. Index probe, not scan
+bool Database_value_taken(const Database_t* self, size_t col_idx, StrSlice_t value, size_t except) {
+    // fields are stored without trailing spaces
+    value = StrSlice_rstrip(value, ' ');
+    HashIndexIter_t it = HashIndexIter_new(&self->hash_indexes[col_idx], StrSlice_hash(value));
+    size_t idx;
+    while (HashIndexIter_next(&it, &idx) == IterOk) {
+        if (idx == except)
+            continue;
+        Database_touch(self, idx, false);
+        if (StrSlice_eq(Database_field(self, idx, col_idx), value))
+            return true;
+    }
+    it = HashIndexIter_new(&self->batch_unique, Database_batch_hash(value, col_idx));
+    while (HashIndexIter_next(&it, &idx) == IterOk)
+        if (StrSlice_eq(Database_line_field(self, self->batch.str + idx * self->row_size, col_idx), value))
+            return true;
+    return false;
+}
+
+// Whether values of unique columns of row `vals` (row #except itself
+// aside) are free. Complains about first taken one
+bool Database_unique_free(const Database_t* self, const StrSlice_t* vals, size_t except) {
+    for (size_t col_idx = 0; col_idx < self->col_num; ++col_idx)
+        if ((self->columns[col_idx].flags & ColumnUnique) && Database_value_taken(self, col_idx, vals[col_idx], except)) {
+            fputs("ERROR: Duplicate value of unique column: \"", stderr);
+            StrSlice_fput(vals[col_idx], stderr);
+            fprintf(stderr, "\" (#%zu)\n", col_idx);
+            return false;
+        }
+    return true;
+}
+
+// Drops rows added to batch after first `rows` of it
+void Database_rollback_to(Database_t* self, size_t rows) {
+    for (size_t pos = rows; pos < self->batch.size / self->row_size; ++pos)
+        Database_index_batched(self, pos, false);
+    if (rows * self->row_size < self->batch.size)
+        self->batch.size = rows * self->row_size;
+}
+
+void Database_rollback(Database_t* self) {
+    Database_rollback_to(self, 0);
+    self->batching = false;
+}
+
+// Appends whole batch to file with one pwrite (one per block for binary
+// table), syncs it and only then counts it as synced in header. So after
+// crash in the middle of commit batch is cut off at first row which
+// didn't reach disk whole (rows of binary table before it may come back
+// deleted, if their alive bits didn't). Batch bypasses log (it only
+// fills new slots), but log is synced too, so everything before
+// `commit` is durable once it returns. Returns number of written rows
+size_t Database_commit(Database_t* self) {
+    size_t rows = self->batch.size / self->row_size;
+    self->batching = false;
+    Wal_sync(self->wal, false);
+    if (rows == 0)
+        return 0;
+    size_t first = self->rows_num;
+    Database_reserve(self, first + rows);
+    for (size_t done = 0; done < rows;) {
+        size_t idx = first + done;
+        // rows of binary table are contiguous only inside block
+        size_t run = rows - done;
+        if (self->format == FormatBinary && run > DATABASE_BLOCK_ROWS - idx % DATABASE_BLOCK_ROWS)
+            run = DATABASE_BLOCK_ROWS - idx % DATABASE_BLOCK_ROWS;
+        pwrite_all(
+            self->fd,
+            self->batch.str + done * self->row_size,
+            run * self->row_size,
+            Database_row_offset(self, idx)
+        );
+        done += run;
+    }
+    for (size_t idx = first; idx < first + rows; ++idx)
+        Database_set_alive(self, idx, true);
+    if (fdatasync(self->fd)) { FATAL("fdatasync() != 0"); }
+    self->rows_num += rows;
+    Database_header(self)->rows_num = self->rows_num;
+    if (msync(self->map, DATABASE_HEADER_SIZE, MS_SYNC)) { FATAL("msync() != 0"); }
+    self->alive_num += rows;
+    for (size_t idx = first; idx < self->rows_num; ++idx)
+        Database_index_row(self, idx, true);
+    Database_release(self, first, self->rows_num);
+    Database_publish(self);
+    self->batch.size = 0;
+    HashIndex_drop(&self->batch_unique);
+    return rows;
+}
+
+// Waits until every change logged so far (see wal.h) is durable. Rows
+// of batch aren't logged, they're durable once `Database_commit` returns
+void Database_sync(Database_t* self) {
+    Wal_sync(self->wal, false);
 }
 
 AddStatus_t Database_add(Database_t* self, StrSlice_t* vals, size_t* row_idx) {
+    // Trailing spaces are dropped in any format: padded scans and B+tree
+    // can't tell them from padding, so hash index and Bloom filter of
+    // binary table mustn't either
+    for (size_t col_idx = 0; col_idx < self->col_num; ++col_idx)
+        vals[col_idx] = StrSlice_rstrip(vals[col_idx], ' ');
     // Check that all slices are not longer than should be
     for (size_t col_idx = 0; col_idx < self->col_num; ++col_idx)
         if (vals[col_idx].size > self->columns[col_idx].size) {
@@ -201,59 +1327,505 @@ AddStatus_t Database_add(Database_t* self, StrSlice_t* vals, size_t* row_idx) {
             fprintf(stderr, "\" (#%zu)\n", col_idx);
             return AddFieldOverflow;
         }
+    if (!Database_unique_free(self, vals, SIZE_MAX))
+        return AddDuplicate;
 
-    // TODO: find row starting with `-` OR go to end
-    // yet, it just goes to end
-    fseek_(self->buffer, 0, SEEK_END);
-    *row_idx = ftell(self->buffer) / self->row_size;
-    printf("%zu\n", *row_idx);
-    fputc_('+', self->buffer);
-    for (size_t col_idx = 0; col_idx < self->col_num; ++col_idx) {
-        StrSlice_fput(vals[col_idx], self->buffer);
-        for (size_t pad = vals[col_idx].size; pad < self->columns[col_idx].size + (col_idx != self->col_num - 1); ++pad)
-            fputc_(' ', self->buffer);
+    // Batched rows are always appended: they're written by single call
+    if (self->batching) {
+        *row_idx = self->rows_num + self->batch.size / self->row_size;
+        if (self->batch.capacity < self->batch.size + self->row_size) {
+            self->batch.capacity = self->batch.capacity * 2 + self->row_size;
+            self->batch.str = realloc(self->batch.str, self->batch.capacity);
+            ANZ(self->batch.str, "Allocation failed");
+        }
+        Database_format_row(self, vals, self->batch.str + self->batch.size);
+        self->batch.size += self->row_size;
+        Database_index_batched(self, *row_idx - self->rows_num, true);
+        return AddOk;
     }
-    fputc_('\n', self->buffer);
+
+    // Reuse slot of deleted row if there is one, otherwise go to end.
+    // Free list may contain rows resurrected after deletion: skip them
+    bool reused = false;
+    while (!reused && FreeList_pop(&self->free_list, row_idx))
+        reused = *row_idx < self->rows_num && Database_dead(self, *row_idx);
+    if (!reused) {
+        *row_idx = self->rows_num;
+        Database_reserve(self, self->rows_num + 1);
+        ++self->rows_num;
+    }
+    char row[self->row_size];
+    Database_format_row(self, vals, row);
+    Database_touch(self, *row_idx, true);
+    Wal_append(self->wal, *row_idx, row, true);
+    // rows past published ones aren't seen by readers, reused slot is
+    if (reused)
+        TableLock_write_begin(&self->lock);
+    memcpy(Database_row(self, *row_idx), row, self->row_size);
+    Database_set_alive(self, *row_idx, true);
+    if (reused)
+        TableLock_write_end(&self->lock);
+    Wal_applied(self->wal);
+    ++self->alive_num;
+    Database_index_row(self, *row_idx, true);
+    Database_publish(self);
     return AddOk;
 }
 
 DeleteStatus_t Database_delete(Database_t* self, size_t idx) {
-    if (fseek(self->buffer, 0, SEEK_END))
-        return DeleteIOErr;
-    long last_idx = ftell(self->buffer);
-    if (last_idx == -1L) { FATAL("ftell() == -1L"); }
-    size_t symbol_idx = idx * self->row_size;
-    if (symbol_idx > last_idx)
+    if (idx >= self->rows_num)
         return DeleteOutOfBounds;
-    fseek_(self->buffer, symbol_idx, SEEK_SET);
-    int symbol = fgetc(self->buffer);
-    if (symbol == EOF) { FATAL("fgetc() == EOF"); }
-    if (symbol == '-')
+    Database_touch(self, idx, true);
+    if (Database_dead(self, idx))
         return DeleteAlready;
-    if (symbol != '+')
+    if (!Database_alive(self, idx))
         return DeleteWrongSymbol;
-    fseek_(self->buffer, symbol_idx, SEEK_SET);
-    fputc_('-', self->buffer);
+    Database_index_row(self, idx, false);
+    Wal_append(self->wal, idx, NULL, false);
+    Database_set_alive(self, idx, false);
+    Wal_applied(self->wal);
+    --self->alive_num;
+    FreeList_push(&self->free_list, idx);
+    Database_publish(self);
     return DeleteOk;
 }
 
 ResurrectStatus_t Database_resurrect(Database_t* self, size_t idx) {
-    fseek_(self->buffer, 0, SEEK_END);
-    long last_idx = ftell(self->buffer);
-    if (last_idx == -1L) { FATAL("ftell() == -1L"); }
-    size_t symbol_idx = idx * self->row_size;
-    if (symbol_idx > last_idx)
+    if (idx >= self->rows_num)
         return ResurrectOutOfBounds;
-    fseek_(self->buffer, symbol_idx, SEEK_SET);
-    int symbol = fgetc(self->buffer);
-    if (symbol == EOF) { FATAL("fgetc() == EOF"); }
-    if (symbol == '+')
+    Database_touch(self, idx, true);
+    if (Database_alive(self, idx))
         return ResurrectAlready;
-    if (symbol != '-')
+    if (!Database_dead(self, idx))
         return ResurrectWrongSymbol;
-    fseek_(self->buffer, symbol_idx, SEEK_SET);
-    fputc_('+', self->buffer);
+    StrSlice_t vals[self->col_num];
+    for (size_t col_idx = 0; col_idx < self->col_num; ++col_idx)
+        vals[col_idx] = Database_field(self, idx, col_idx);
+    // values of deleted row may have been taken since
+    if (!Database_unique_free(self, vals, idx))
+        return ResurrectDuplicate;
+    // Slot stays in free list, `Database_add` skips alive slots
+    Wal_append(self->wal, idx, NULL, true);
+    Database_set_alive(self, idx, true);
+    Wal_applied(self->wal);
+    ++self->alive_num;
+    Database_index_row(self, idx, true);
+    Database_publish(self);
     return ResurrectOk;
 }
 
+// Prints row #idx (dead one too) as `printall` does. Only that row is
+// read, whatever size of table is
+GetStatus_t Database_get(const Database_t* self, size_t idx) {
+    if (idx >= self->rows_num)
+        return GetOutOfBounds;
+    char line[self->row_size];
+    StrSlice_t values[self->col_num];
+    RowView_t row = RowView_with(values);
+    switch (Database_read_row(self, idx, line, &row.alive)) {
+        case IterOk:
+            break;
+        case IterTotalErr:
+            return GetCrashed;
+        default:
+            return GetWrongSymbol;
+    }
+    row.idx = idx;
+    row.line = line;
+    for (size_t i = 0; i < self->col_num; ++i)
+        row.values[i] = Database_line_field(self, line, i);
+    RowView_print(&row, self->col_num, true);
+    return GetOk;
+}
+
+// Sets column #col_idx of alive row #idx to `value`. Only bytes of that
+// field (and its size for binary table) are rewritten and only indexes
+// of that column are updated
+UpdateStatus_t Database_update(Database_t* self, size_t idx, size_t col_idx, StrSlice_t value) {
+    if (idx >= self->rows_num)
+        return UpdateOutOfBounds;
+    if (col_idx >= self->col_num)
+        return UpdateBadColumn;
+    // as in `Database_add`
+    value = StrSlice_rstrip(value, ' ');
+    Database_touch(self, idx, true);
+    if (Database_dead(self, idx))
+        return UpdateDead;
+    if (!Database_alive(self, idx))
+        return UpdateWrongSymbol;
+    if (value.size > self->columns[col_idx].size)
+        return UpdateFieldOverflow;
+    unsigned flags = self->columns[col_idx].flags;
+    if ((flags & ColumnUnique) && Database_value_taken(self, col_idx, value, idx))
+        return UpdateDuplicate;
+    Database_index_field(self, idx, col_idx, false, flags);
+    // new image is logged first, then only changed bytes are copied
+    char row[self->row_size];
+    memcpy(row, Database_row(self, idx), self->row_size);
+    size_t offset = self->offsets[col_idx];
+    memcpy(row + offset, value.str, value.size);
+    memset(row + offset + value.size, ' ', self->columns[col_idx].size - value.size);
+    if (self->format == FormatBinary) {
+        uint16_t size = value.size;
+        memcpy(row + col_idx * sizeof(uint16_t), &size, sizeof(size));
+    }
+    Wal_append(self->wal, idx, row, true);
+    TableLock_write_begin(&self->lock);
+    memcpy(Database_row(self, idx) + offset, row + offset, self->columns[col_idx].size);
+    if (self->format == FormatBinary)
+        memcpy(Database_row(self, idx) + col_idx * sizeof(uint16_t), row + col_idx * sizeof(uint16_t), sizeof(uint16_t));
+    TableLock_write_end(&self->lock);
+    Wal_applied(self->wal);
+    Database_index_field(self, idx, col_idx, true, flags);
+    return UpdateOk;
+}
+
+// Flags of column #col_idx selecting structures usable for lookups.
+// Reader has none of them (they're writer's), it always scans
+unsigned Database_lookup_flags(const Database_t* self, size_t col_idx) {
+    return self->lock.writer ? self->columns[col_idx].flags : 0;
+}
+
+// Prints alive row #idx if it is valid. Returns number of printed rows
+size_t Database_print_found(const Database_t* self, size_t idx, RowView_t* row) {
+    if (Database_view(self, idx, row) != IterOk || !row->alive)
+        return 0;
+    RowView_print(row, self->col_num, false);
+    return 1;
+}
+
+// Full scans are split into rounds of `threads` ranges of this many rows.
+// Every worker preads its range block by block into own buffer, filters
+// and formats rows into own output; outputs are then written in order by
+// single writev. Scan with limit on number of rows is done by calling
+// thread only, which stops once it has found them
+#define SCAN_TASK_ROWS ((size_t) 1 << 16)
+// Smaller tables are scanned by calling thread only
+#define SCAN_PARALLEL_MIN_ROWS ((size_t) 1 << 17)
+
+typedef struct {
+    const Database_t* database;
+    // NULL to take every row (for `print`)
+    const ScanPred_t* pred;
+    bool filter_dead;
+    OutputFormat_t format;
+    // of columns, for formats naming them
+    const char* const* names;
+    // rows before #skip_below are read (with block they're in), not taken
+    size_t skip_below;
+    // task stops after taking this many rows
+    size_t limit;
+    size_t first;
+    size_t rows;
+    // SCAN_BLOCK rows
+    char* buf;
+    String_t out;
+    size_t found;
+    // writer died in the middle of rewrite, see `TableLock_crashed`
+    bool crashed;
+} ScanTask_t;
+
+// Appends row as `Database_print` shows it
+void ScanTask_push_row(ScanTask_t* self, size_t idx, const char* line, bool alive) {
+    const Database_t* database = self->database;
+    StrSlice_t values[database->col_num];
+    for (size_t i = 0; i < database->col_num; ++i)
+        values[i] = Database_line_field(database, line, i);
+    Output_row(&self->out, self->format, self->names, database->col_num, idx, !self->filter_dead, alive, values);
+}
+
+// Size of buffer for SCAN_BLOCK rows (with bitmaps for binary table)
+size_t ScanTask_buf_size(const Database_t* database) {
+    return Database_end_offset(database, SCAN_BLOCK) - DATABASE_HEADER_SIZE;
+}
+
+void* ScanTask_run(void* arg) {
+    ScanTask_t* self = arg;
+    const Database_t* database = self->database;
+    size_t row_size = database->row_size;
+    bool binary = database->format == FormatBinary;
+    ScanKernel_t kernel = self->pred != NULL ? scan_kernel(self->pred->op) : NULL;
+    uint32_t hits[SCAN_BLOCK];
+    self->out.size = 0;
+    self->found = 0;
+    self->crashed = false;
+    for (size_t done = 0; done < self->rows && self->found < self->limit;) {
+        size_t rows = self->rows - done < SCAN_BLOCK ? self->rows - done : SCAN_BLOCK;
+        size_t first = self->first + done;
+        // blocks of binary table are read whole, bitmaps included
+        size_t begin = binary ? Database_block_offset(database, first) : Database_row_offset(database, first);
+        // reader reads rows again if writer rewrote some meanwhile
+        uint64_t seq;
+        do {
+            if (!TableLock_read_begin(&database->lock, &seq)) {
+                self->crashed = true;
+                return NULL;
+            }
+            pread_all(database->fd, self->buf, Database_end_offset(database, first + rows) - begin, begin);
+        } while (TableLock_read_retry(&database->lock, seq));
+        // rows are contiguous only inside block of binary table
+        size_t group = binary ? DATABASE_BLOCK_ROWS : rows;
+        for (size_t part = 0; part < rows; part += group) {
+            size_t part_rows = rows - part < group ? rows - part : group;
+            const char* base = self->buf + Database_row_offset(database, first + part) - begin;
+            const uint64_t* bitmap = binary ? (const uint64_t*) (base - DATABASE_LINE_SIZE) : NULL;
+            size_t hits_num = 0;
+            if (kernel != NULL)
+                hits_num = kernel(base, part_rows, row_size, self->pred, hits);
+            else
+                for (size_t i = 0; i < part_rows; ++i)
+                    hits[hits_num++] = i;
+            for (size_t i = 0; i < hits_num && self->found < self->limit; ++i) {
+                size_t idx = first + part + hits[i];
+                if (idx < self->skip_below)
+                    continue;
+                const char* line = base + hits[i] * row_size;
+                bool alive;
+                if (binary) {
+                    alive = bitmap[hits[i] / 64] >> (hits[i] % 64) & 1;
+                } else {
+                    if (line[row_size - 1] != '\n') {
+                        fprintf(stderr, "ERROR: row #%zu is not terminated with \\n\n", idx);
+                        FATAL("database broken");
+                    }
+                    if (line[0] != '+' && line[0] != '-') {
+                        fprintf(stderr, "ERROR: line starts with wrong character: '%c'\n", line[0]);
+                        continue;
+                    }
+                    alive = line[0] == '+';
+                }
+                if (self->filter_dead && !alive)
+                    continue;
+                ScanTask_push_row(self, idx, line, alive);
+                ++self->found;
+            }
+        }
+        done += rows;
+    }
+    return NULL;
+}
+
+// Prints rows (alive only if `filter_dead`) matching `pred` (every row if
+// it's NULL) in row order, splitting work between `self->threads`. Of
+// them only `options->limit` rows starting from #`options->offset` are
+// printed: rows are fixed width, so scan starts right there (at block
+// containing it for binary table). Returns number of printed rows
+size_t Database_scan_rows(Database_t* self, const ScanPred_t* pred, bool filter_dead, const PrintOptions_t* options) {
+    size_t start = options->offset;
+    if (self->format == FormatBinary)
+        start -= start % DATABASE_BLOCK_ROWS;
+    size_t threads =
+        self->rows_num >= start + SCAN_PARALLEL_MIN_ROWS && options->limit == SIZE_MAX
+        ? self->threads : 1;
+    const char* names[self->col_num];
+    for (size_t i = 0; i < self->col_num; ++i)
+        names[i] = self->columns[i].name;
+    ScanTask_t tasks[threads];
+    pthread_t handles[threads];
+    for (size_t i = 0; i < threads; ++i) {
+        ScanTask_t task = {
+            self, pred, filter_dead, options->format, names, options->offset, options->limit,
+            0, 0, malloc(ScanTask_buf_size(self)), String_new(), 0, false
+        };
+        ANZ(task.buf, "Allocation failed");
+        tasks[i] = task;
+    }
+    size_t found = 0;
+    for (size_t round = start; round < self->rows_num && found < options->limit; round += threads * SCAN_TASK_ROWS) {
+        size_t spawned = 0;
+        for (size_t i = 0; i < threads; ++i) {
+            size_t first = round + i * SCAN_TASK_ROWS;
+            if (first >= self->rows_num)
+                break;
+            tasks[i].first = first;
+            tasks[i].rows = self->rows_num - first < SCAN_TASK_ROWS ? self->rows_num - first : SCAN_TASK_ROWS;
+            tasks[i].limit = options->limit - found;
+            ++spawned;
+        }
+        if (spawned == 1) {
+            ScanTask_run(&tasks[0]);
+        } else {
+            for (size_t i = 0; i < spawned; ++i)
+                if (pthread_create(&handles[i], NULL, ScanTask_run, &tasks[i])) {
+                    FATAL("pthread_create() failed");
+                }
+            for (size_t i = 0; i < spawned; ++i)
+                pthread_join(handles[i], NULL);
+        }
+        StrSlice_t outs[spawned];
+        bool crashed = false;
+        for (size_t i = 0; i < spawned; ++i) {
+            outs[i] = String_borrow(&tasks[i].out);
+            found += tasks[i].found;
+            crashed |= tasks[i].crashed;
+        }
+        Output_write(outs, spawned);
+        if (crashed) {
+            ERR("Writer died in the middle of rewrite, scan is stopped. Table is recovered by next command");
+            break;
+        }
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        free(tasks[i].buf);
+        String_drop(&tasks[i].out);
+    }
+    return found;
+}
+
+// Scans column store of column #col_idx block by block: kernel sees
+// only bytes of that column, matching alive rows are read from table
+// (and printed) one by one. Returns number of found rows
+size_t Database_scan_column(Database_t* self, size_t col_idx, const ScanPred_t* pred) {
+    const ColumnStore_t* store = &self->column_stores[col_idx];
+    ScanPred_t column_pred = *pred;
+    column_pred.offset = 0;
+    ScanKernel_t kernel = scan_kernel(pred->op);
+    uint32_t hits[COLUMN_STORE_BLOCK_ROWS];
+    StrSlice_t values[self->col_num];
+    RowView_t row = RowView_with(values);
+    size_t found = 0;
+    for (size_t first = 0; first < self->rows_num; first += COLUMN_STORE_BLOCK_ROWS) {
+        size_t rows = self->rows_num - first;
+        if (rows > COLUMN_STORE_BLOCK_ROWS)
+            rows = COLUMN_STORE_BLOCK_ROWS;
+        // only deleted rows may be missing in the end of store
+        if (!ColumnStore_has(store, first))
+            break;
+        while (!ColumnStore_has(store, first + rows - 1))
+            --rows;
+        size_t hits_num = kernel(ColumnStore_value(store, first), rows, store->width, &column_pred, hits);
+        for (size_t i = 0; i < hits_num; ++i)
+            if (ColumnStore_alive(store, first + hits[i]))
+                found += Database_print_found(self, first + hits[i], &row);
+    }
+    return found;
+}
+
+// Prints alive rows where column #col_idx matches `pred` in row order,
+// using vectorized scan kernel over column store of the column if there
+// is one, over raw rows otherwise. Returns number of found rows
+size_t Database_scan(Database_t* self, size_t col_idx, const ScanPred_t* pred) {
+    if (Database_lookup_flags(self, col_idx) & ColumnColumnar)
+        return Database_scan_column(self, col_idx, pred);
+    return Database_scan_rows(self, pred, true, &PRINT_DEFAULTS);
+}
+
+// Prints alive rows where column #col_idx is in [lo, hi] (both are
+// compared as padded to column width, byte by byte). Ordered by value
+// if column has ordered index, by row otherwise.
+// Returns number of found rows
+size_t Database_find_range(Database_t* self, size_t col_idx, StrSlice_t lo, StrSlice_t hi) {
+    size_t size = self->columns[col_idx].size;
+    char lo_key[size], hi_key[size];
+    memset(lo_key, ' ', size);
+    memcpy(lo_key, lo.str, lo.size < size ? lo.size : size);
+    memset(hi_key, ' ', size);
+    memcpy(hi_key, hi.str, hi.size < size ? hi.size : size);
+    // field equal to truncated `lo` is less than `lo` itself
+    // (and field equal to truncated `hi` is less than `hi`, as needed)
+    int lo_min_cmp = lo.size > size ? 1 : 0;
+
+    if (!(Database_lookup_flags(self, col_idx) & ColumnOrderedIndex)) {
+        ScanPred_t pred = {
+            .op = ScanRange, .offset = self->offsets[col_idx], .width = size,
+            .needle = lo_key, .needle_size = size, .upper = hi_key, .lower_cmp = lo_min_cmp
+        };
+        return Database_scan(self, col_idx, &pred);
+    }
+    size_t found = 0;
+    StrSlice_t values[self->col_num];
+    RowView_t row = RowView_with(values);
+    BTreeIter_t it = BTree_lower_bound(&self->btrees[col_idx], lo_key, size);
+    const char* key;
+    uint64_t idx;
+    while (BTreeIter_next(&it, &key, &idx) == IterOk) {
+        if (memcmp(key, hi_key, size) > 0)
+            break;
+        if (memcmp(key, lo_key, size) >= lo_min_cmp)
+            found += Database_print_found(self, idx, &row);
+    }
+    return found;
+}
+
+// Prints alive rows where column #col_idx starts with `prefix`.
+// Returns number of found rows
+size_t Database_find_prefix(Database_t* self, size_t col_idx, StrSlice_t prefix) {
+    if (prefix.size > self->columns[col_idx].size)
+        return 0;
+    if (!(Database_lookup_flags(self, col_idx) & ColumnOrderedIndex)) {
+        // equality of first `prefix.size` bytes of field
+        ScanPred_t pred = {
+            .op = ScanEq, .offset = self->offsets[col_idx], .width = prefix.size,
+            .needle = prefix.str, .needle_size = prefix.size
+        };
+        return Database_scan(self, col_idx, &pred);
+    }
+    size_t found = 0;
+    StrSlice_t values[self->col_num];
+    RowView_t row = RowView_with(values);
+    BTreeIter_t it = BTree_lower_bound(&self->btrees[col_idx], prefix.str, prefix.size);
+    const char* key;
+    uint64_t idx;
+    while (
+        BTreeIter_next(&it, &key, &idx) == IterOk
+        && memcmp(key, prefix.str, prefix.size) == 0
+    )
+        found += Database_print_found(self, idx, &row);
+    return found;
+}
+
+// Prints alive rows where column #col_idx contains `substr`.
+// Returns number of found rows
+size_t Database_find_substr(Database_t* self, size_t col_idx, StrSlice_t substr) {
+    if (substr.size > self->columns[col_idx].size)
+        return 0;
+    // empty substring is contained everywhere
+    if (substr.size == 0)
+        return Database_find_prefix(self, col_idx, substr);
+    ScanPred_t pred = {
+        .op = ScanSubstr, .offset = self->offsets[col_idx], .width = self->columns[col_idx].size,
+        .needle = substr.str, .needle_size = substr.size
+    };
+    return Database_scan(self, col_idx, &pred);
+}
+
+// Prints all alive rows where column #col_idx is equal to `value`.
+// Returns number of found rows
+size_t Database_find(Database_t* self, size_t col_idx, StrSlice_t value) {
+    unsigned flags = Database_lookup_flags(self, col_idx);
+    // fields are stored (and hashed) without trailing spaces
+    value = StrSlice_rstrip(value, ' ');
+    // most values looked up aren't there: no need to look further
+    if ((flags & ColumnBloom) && !BloomFilter_may_contain(&self->blooms[col_idx], StrSlice_hash(value)))
+        return 0;
+    if (!(flags & ColumnHashIndex) && (flags & ColumnOrderedIndex))
+        return Database_find_range(self, col_idx, value, value);
+    size_t found = 0;
+    StrSlice_t values[self->col_num];
+    RowView_t row = RowView_with(values);
+    if (flags & ColumnHashIndex) {
+        HashIndexIter_t it = HashIndexIter_new(&self->hash_indexes[col_idx], StrSlice_hash(value));
+        size_t idx;
+        while (HashIndexIter_next(&it, &idx) == IterOk)
+            if (
+                Database_view(self, idx, &row) == IterOk
+                && StrSlice_eq(row.values[col_idx], value)
+            ) {
+                RowView_print(&row, self->col_num, false);
+                ++found;
+            }
+    } else if (value.size <= self->columns[col_idx].size) {
+        size_t size = self->columns[col_idx].size;
+        char padded[size];
+        memset(padded, ' ', size);
+        memcpy(padded, value.str, value.size);
+        ScanPred_t pred = {
+            .op = ScanEq, .offset = self->offsets[col_idx], .width = size,
+            .needle = padded, .needle_size = size
+        };
+        found = Database_scan(self, col_idx, &pred);
+    }
+    return found;
+}
+
 #endif
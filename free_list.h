@@ -0,0 +1,111 @@
+#ifndef __FREE_LIST_H__
+#define __FREE_LIST_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+// Stack of indices of deleted rows, whose slots can be claimed by `add`.
+// Entries are validated lazily when popped: row could have been
+// resurrected (or even deleted twice) since it was pushed
+typedef struct {
+    size_t* slots;
+    size_t size;
+    size_t capacity;
+} FreeList_t;
+
+// Layout of sidecar file: header followed by `size` slots
+typedef struct {
+    char magic[8];
+    // number of rows in table at the moment of saving; list is
+    // trusted only if table still has the same number of rows
+    uint64_t rows_num;
+    uint64_t size;
+} FreeListHeader_t;
+
+static const char FREE_LIST_MAGIC[8] = "09FREE1";
+
+FreeList_t FreeList_new(void) {
+    FreeList_t res = { NULL, 0, 0 };
+    return res;
+}
+
+void FreeList_drop(FreeList_t* self) {
+    free(self->slots);
+    self->slots = NULL;
+    self->size = self->capacity = 0;
+}
+
+void FreeList_push(FreeList_t* self, size_t slot) {
+    if (self->size == self->capacity) {
+        self->capacity = self->capacity == 0 ? 64 : self->capacity * 2;
+        self->slots = realloc(self->slots, self->capacity * sizeof(size_t));
+        ANZ(self->slots, "Allocation failed");
+    }
+    self->slots[self->size++] = slot;
+}
+
+bool FreeList_pop(FreeList_t* self, size_t* slot) {
+    if (self->size == 0)
+        return false;
+    *slot = self->slots[--self->size];
+    return true;
+}
+
+// Reads list saved by `FreeList_save` and removes the file, so that
+// list which is not saved on proper close is never trusted.
+// Returns false if there is no valid list for table of `rows_num` rows
+bool FreeList_load(FreeList_t* self, const char* path, size_t rows_num) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
+    bool ok = false;
+    FreeListHeader_t header;
+    if (
+        fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, FREE_LIST_MAGIC, sizeof(FREE_LIST_MAGIC)) != 0
+        || header.rows_num != rows_num
+    )
+        goto wipeout;
+    self->size = 0;
+    for (uint64_t i = 0; i < header.size; ++i) {
+        uint64_t slot;
+        if (fread(&slot, sizeof(slot), 1, file) != 1)
+            goto wipeout;
+        FreeList_push(self, slot);
+    }
+    ok = true;
+
+    wipeout:
+    fclose(file);
+    remove(path);
+    if (!ok)
+        self->size = 0;
+    return ok;
+}
+
+void FreeList_save(const FreeList_t* self, const char* path, size_t rows_num) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        ERR("Can't save free list, it will be rebuilt on next open");
+        return;
+    }
+    FreeListHeader_t header = { {0}, rows_num, self->size };
+    memcpy(header.magic, FREE_LIST_MAGIC, sizeof(FREE_LIST_MAGIC));
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t i = 0; ok && i < self->size; ++i) {
+        uint64_t slot = self->slots[i];
+        ok = fwrite(&slot, sizeof(slot), 1, file) == 1;
+    }
+    if (fclose(file) || !ok) {
+        ERR("Can't save free list, it will be rebuilt on next open");
+        remove(path);
+    }
+}
+
+#endif
@@ -1,12 +1,62 @@
 #ifndef __FS_FALLIBLE__
 #define __FS_FALLIBLE__
 
+#include <fcntl.h>
+#include <libgen.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "utils.h"
 
 #define fflush_(buffer) if (fflush(buffer)) { FATAL("fflush() != 0"); }
 #define fputc_(sym, buffer) if (fputc(sym, buffer) == EOF) { FATAL("fputc() == EOF"); }
 #define fseek_(buffer, where, from) if (fseek(buffer, where, from)) { FATAL("fseek() != 0"); }
+#define ftruncate_(fd, size) if (ftruncate(fd, size)) { FATAL("ftruncate() != 0"); }
+#define munmap_(ptr, size) if (munmap(ptr, size)) { FATAL("munmap() != 0"); }
+
+void write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t res = write(fd, data, size);
+        if (res <= 0) { FATAL("write() failed"); }
+        data += res;
+        size -= res;
+    }
+}
+
+void pwrite_all(int fd, const char* data, size_t size, size_t offset) {
+    while (size > 0) {
+        ssize_t res = pwrite(fd, data, size, offset);
+        if (res <= 0) { FATAL("pwrite() failed"); }
+        data += res;
+        size -= res;
+        offset += res;
+    }
+}
+
+// Reads exactly `size` bytes, file must be long enough
+void pread_all(int fd, char* data, size_t size, size_t offset) {
+    while (size > 0) {
+        ssize_t res = pread(fd, data, size, offset);
+        if (res <= 0) { FATAL("pread() failed"); }
+        data += res;
+        size -= res;
+        offset += res;
+    }
+}
+
+// Fsyncs directory containing `path`, so that rename into it is durable
+void fsync_parent(const char* path) {
+    char* copy = strdup(path);
+    ANZ(copy, "Allocation failed");
+    int dir = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+    if (dir != -1) {
+        fsync(dir);
+        close(dir);
+    }
+    free(copy);
+}
 
 #endif
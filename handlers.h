@@ -1,11 +1,15 @@
 #ifndef __HANDLERS_H__
 #define __HANDLERS_H__
 
+#include "arena.h"
+#include "copy.h"
 #include "database.h"
 #include "my_string.h"
 #include "parse_args.h"
 #include "split_space.h"
 #include "utils.h"
+#include "migrate.h"
+#include "vacuum.h"
 
 enum Flow { FlowExit, FlowContinue };
 typedef enum Flow (*InputHandler)(ParseArgs_t, Database_t*);
@@ -13,196 +17,907 @@ struct PatternHandler {
     const char* pattern;
     const char* help_text;
     InputHandler handler;
+    // command changes table, so it needs writer lock
+    bool writes;
+    // command switches table of whole process: refused when served, as
+    // it'd switch every client
+    bool switches;
 };
 
 enum Flow exit_handler(ParseArgs_t it, Database_t* database);
 enum Flow help_handler(ParseArgs_t it, Database_t* database);
 enum Flow add_handler(ParseArgs_t it, Database_t* database);
+enum Flow begin_handler(ParseArgs_t it, Database_t* database);
+enum Flow commit_handler(ParseArgs_t it, Database_t* database);
+enum Flow rollback_handler(ParseArgs_t it, Database_t* database);
+enum Flow sync_handler(ParseArgs_t it, Database_t* database);
+enum Flow import_handler(ParseArgs_t it, Database_t* database);
 enum Flow print_handler(ParseArgs_t it, Database_t* database);
 enum Flow printall_handler(ParseArgs_t it, Database_t* database);
+enum Flow find_handler(ParseArgs_t it, Database_t* database);
+enum Flow get_handler(ParseArgs_t it, Database_t* database);
+enum Flow update_handler(ParseArgs_t it, Database_t* database);
 enum Flow delete_handler(ParseArgs_t it, Database_t* database);
 enum Flow resurrect_handler(ParseArgs_t it, Database_t* database);
+enum Flow vacuum_handler(ParseArgs_t it, Database_t* database);
+enum Flow remap_handler(ParseArgs_t it, Database_t* database);
+enum Flow migrate_handler(ParseArgs_t it, Database_t* database);
+enum Flow create_handler(ParseArgs_t it, Database_t* database);
+enum Flow copy_handler(ParseArgs_t it, Database_t* database);
+enum Flow export_handler(ParseArgs_t it, Database_t* database);
+enum Flow cache_handler(ParseArgs_t it, Database_t* database);
+
+// Indices of commands in `handlers`
+enum Command {
+    CommandExit,
+    CommandHelp,
+    CommandAdd,
+    CommandBegin,
+    CommandCommit,
+    CommandRollback,
+    CommandSync,
+    CommandImport,
+    CommandPrint,
+    CommandPrintall,
+    CommandFind,
+    CommandGet,
+    CommandUpdate,
+    CommandDelete,
+    CommandResurrect,
+    CommandVacuum,
+    CommandRemap,
+    CommandMigrate,
+    CommandCreate,
+    CommandCopy,
+    CommandExport,
+    CommandCache,
+    CommandUnknown
+};
 
 static const struct PatternHandler handlers[] = {
-    { "exit", "exit -- close shell (^D also works)", exit_handler },
-    { "help", "help [cmd] -- print help on `cmd` or general help", help_handler },
-    { "add", "add <value1> ... -- add row to table, setting value of `column1` to `value1`", add_handler},
-    { "print", "print -- print alive entries into console", print_handler },
-    { "printall", "printall -- print whole table into console", printall_handler },
-    { "delete", "delete <idx> -- mark row #<idx> as deleted", delete_handler },
-    { "resurrect", "resurrect <idx> -- unmark deletion of row #<idx>", resurrect_handler }
+    [CommandExit] = { "exit", "exit -- close shell (^D also works)", exit_handler },
+    [CommandHelp] = { "help", "help [cmd] -- print help on `cmd` or general help", help_handler },
+    [CommandAdd] = { "add", "add <value1> ... -- add row to table, setting value of `column1` to `value1`", add_handler, true },
+    [CommandBegin] = { "begin", "begin -- start batch: following `add`s are written to file at once on `commit`", begin_handler, true },
+    [CommandCommit] = { "commit", "commit -- write and sync rows added since `begin`", commit_handler, true },
+    [CommandRollback] = { "rollback", "rollback -- discard rows added since `begin`", rollback_handler },
+    [CommandSync] = { "sync", "sync -- wait until changes made by `add`, `update`, `delete` and `resurrect` are on disk (they're synced in groups of up to 256 changes or 10 ms, so crash may lose that much of latest ones otherwise)", sync_handler },
+    [CommandImport] = { "import", "import <file> -- add rows from file, one row per line (values as in `add`), all or nothing", import_handler, true },
+    [CommandPrint] = { "print", "print [--format pipe|tsv|csv|json] [--offset <idx>] [--limit <num>] -- print alive entries into console (at most <num> of them, starting from row #<idx>)", print_handler },
+    [CommandPrintall] = { "printall", "printall [--format pipe|tsv|csv|json] [--offset <idx>] [--limit <num>] -- print whole table into console (options as in `print`)", printall_handler },
+    [CommandFind] = { "find", "find [--prefix|--contains] <col_idx> <value> | find --range <col_idx> <lo> <hi> -- print alive entries where column #<col_idx> is equal to <value> (starts with it, contains it, lies in [<lo>, <hi>])", find_handler },
+    [CommandGet] = { "get", "get <idx> -- print row #<idx> (deleted one too)", get_handler },
+    [CommandUpdate] = { "update", "update <row_idx> <col_idx> <value> -- set value of column #<col_idx> in alive row #<row_idx> to <value>", update_handler, true },
+    [CommandDelete] = { "delete", "delete <idx> -- mark row #<idx> as deleted (its slot may be reused by `add`)", delete_handler, true },
+    [CommandResurrect] = { "resurrect", "resurrect <idx> -- unmark deletion of row #<idx> (until its slot is reused by `add`)", resurrect_handler, true },
+    [CommandVacuum] = { "vacuum", "vacuum [--keep-remap] -- rewrite table without deleted rows (changes indices of rows; keep translation table for `remap`)", vacuum_handler, true },
+    [CommandRemap] = { "remap", "remap <idx> -- translate row index from before `vacuum --keep-remap` into current one", remap_handler },
+    [CommandMigrate] = { "migrate", "migrate <size1> ... -- rewrite table so that `column1` has size `size1` (indices of rows are kept)", migrate_handler, true },
+    [CommandCreate] = { "create", "create [--binary] <name> <column1> <size1>[:flag,...] ... -- create table with given columns in file `<name>.txt` and switch to it, not over `--serve` socket (`--binary`: compact rows without separators; flags: `hash`, `ordered` indexes, `columnar` copy for scans, `bloom` filter for `find` of missing values, `unique` values, checked by hash index)", create_handler, false, true },
+    [CommandCopy] = { "copy", "copy <file> -- add alive rows of table in <file> (with the same number of columns), all or nothing", copy_handler, true },
+    [CommandExport] = { "export", "export [--text|--binary] <file> -- write table into new <file> in given format (same as current by default)", export_handler },
+    [CommandCache] = { "cache", "cache -- print hits and misses of page cache of row lookups (see `--cache-mb`)", cache_handler }
 };
 static const size_t handlers_num = sizeof(handlers) / sizeof(struct PatternHandler);
 
+// Longest command name (`resurrect`), checked against `handlers` by
+// bench/dispatch.c
+#define COMMAND_MAX_SIZE 9
+#define COMMAND_KEY(size, first, last) ((uint32_t) (size) << 16 | (uint32_t) (unsigned char) (first) << 8 | (unsigned char) (last))
+
+// Command named `name`, CommandUnknown if there's none. Commands are told
+// apart by length, first and last letter (name colliding with existing
+// one is duplicate case, so it doesn't compile), then only that single
+// candidate is compared in full
+enum Command Command_lookup(StrSlice_t name) {
+    if (name.size == 0 || name.size > COMMAND_MAX_SIZE)
+        return CommandUnknown;
+    enum Command res;
+    switch (COMMAND_KEY(name.size, name.str[0], name.str[name.size - 1])) {
+        case COMMAND_KEY(4, 'e', 't'): res = CommandExit; break;
+        case COMMAND_KEY(4, 'h', 'p'): res = CommandHelp; break;
+        case COMMAND_KEY(3, 'a', 'd'): res = CommandAdd; break;
+        case COMMAND_KEY(5, 'b', 'n'): res = CommandBegin; break;
+        case COMMAND_KEY(6, 'c', 't'): res = CommandCommit; break;
+        case COMMAND_KEY(8, 'r', 'k'): res = CommandRollback; break;
+        case COMMAND_KEY(4, 's', 'c'): res = CommandSync; break;
+        case COMMAND_KEY(6, 'i', 't'): res = CommandImport; break;
+        case COMMAND_KEY(5, 'p', 't'): res = CommandPrint; break;
+        case COMMAND_KEY(8, 'p', 'l'): res = CommandPrintall; break;
+        case COMMAND_KEY(4, 'f', 'd'): res = CommandFind; break;
+        case COMMAND_KEY(3, 'g', 't'): res = CommandGet; break;
+        case COMMAND_KEY(6, 'u', 'e'): res = CommandUpdate; break;
+        case COMMAND_KEY(6, 'd', 'e'): res = CommandDelete; break;
+        case COMMAND_KEY(9, 'r', 't'): res = CommandResurrect; break;
+        case COMMAND_KEY(6, 'v', 'm'): res = CommandVacuum; break;
+        case COMMAND_KEY(5, 'r', 'p'): res = CommandRemap; break;
+        case COMMAND_KEY(7, 'm', 'e'): res = CommandMigrate; break;
+        case COMMAND_KEY(6, 'c', 'e'): res = CommandCreate; break;
+        case COMMAND_KEY(4, 'c', 'y'): res = CommandCopy; break;
+        case COMMAND_KEY(6, 'e', 't'): res = CommandExport; break;
+        case COMMAND_KEY(5, 'c', 'e'): res = CommandCache; break;
+        default:
+            return CommandUnknown;
+    }
+    return memcmp(handlers[res].pattern, name.str, name.size) == 0 ? res : CommandUnknown;
+}
+
 
 enum Flow exit_handler(ParseArgs_t it, Database_t* database) {
-    String_t word = String_new();
-    ParseArgs_next(&it, &word);
-    if (word.str != NULL) {
+    StrSlice_t word;
+    if (ParseArgs_next(&it, &word) != IterEnd)
         puts("`exit` doesn't accept arguments. Anyway, exiting");
-        String_drop(&word);
-    }
     return FlowExit;
 }
 
 enum Flow help_handler(ParseArgs_t it, Database_t* database) {
-    String_t word = String_new();
-    String_t temp = String_new();
-    ParseArgs_next(&it, &word);
-    ParseArgs_next(&it, &temp);
-    if (temp.str != NULL) {
+    StrSlice_t word;
+    StrSlice_t temp;
+    IterRes res = ParseArgs_next(&it, &word);
+    if (res == IterOk && ParseArgs_next(&it, &temp) != IterEnd) {
         puts("`help` accepts either one or no arguments");
-        puts(handlers[0].help_text);
-        goto wipeout;
+        puts(handlers[CommandHelp].help_text);
+        return FlowContinue;
     }
-    if (word.str == NULL) {
+    if (res != IterOk) {
         puts("General syntax: <cmd> <args...>\n");
         for (size_t i = 0; i < handlers_num; ++i)
             puts(handlers[i].help_text);
     } else {
-        size_t i = 0;
-        for (; i < handlers_num; ++i)
-            if (String_eq_str(word, handlers[i].pattern)) {
-                puts(handlers[i].help_text);
-                break;
-            }
-        if (i == handlers_num) {
+        enum Command cmd = Command_lookup(word);
+        if (cmd != CommandUnknown) {
+            puts(handlers[cmd].help_text);
+        } else {
             fputs("Unknown command `", stdout);
-            StrSlice_fput(String_borrow(&word), stdout);
+            StrSlice_fput(word, stdout);
             puts("`. Use `help` for list of commands");
         }
     }
-    wipeout:
-    String_drop(&word);
-    String_drop(&temp);
     return FlowContinue;
 }
 
-enum Flow add_handler(ParseArgs_t it, Database_t* database) {
-    String_t owned[database->col_num];
-
-    bool die = false;
-    for (size_t i = 0; i < database->col_num; ++i) {
-        owned[i] = String_new();
-        switch (ParseArgs_next(&it, &owned[i])) {
+// Parses exactly `num` values into `values`. On failure reports error
+// and returns false
+bool parse_values(ParseArgs_t* it, StrSlice_t* values, size_t num) {
+    for (size_t i = 0; i < num; ++i)
+        switch (ParseArgs_next(it, &values[i])) {
             case IterOk:
                 break;
-            case IterTotalErr:
-                ERR("Invalid arguments");
-                die = true;
-                break;
             case IterEnd:
-                fprintf(stderr, "Not enough arguments: received %zu, expected %zu\n", i, database->col_num);
-                die = true;
-                break;
+                fprintf(stderr, "Not enough arguments: received %zu, expected %zu\n", i, num);
+                return false;
             default:
-                ; // unreachable
+                ERR("Invalid arguments");
+                return false;
         }
-        if (die) {
-            while (i != 0)
-                String_drop(&owned[--i]);
-            return FlowContinue;
+
+    StrSlice_t temp;
+    if (ParseArgs_next(it, &temp) != IterEnd) {
+        fprintf(stderr, "Too many arguments: expected %zu\n", num);
+        return false;
+    }
+    return true;
+}
+
+// Parses `<size>[:flag,...]` of `create`, flags are `hash`, `ordered`,
+// `columnar`, `bloom` and `unique` (which implies `hash`). Returns false (and complains) if it's malformed
+bool parse_column_spec(StrSlice_t spec, Column_t* column) {
+    const char* colon = memchr(spec.str, ':', spec.size);
+    size_t size_len = colon != NULL ? (size_t) (colon - spec.str) : spec.size;
+    ssize_t size = StrSlice_into_decimal(StrSlice_new(spec.str, size_len));
+    if (size_len == 0 || size <= 0) {
+        ERR("<size> must be positive decimal");
+        return false;
+    }
+    column->size = size;
+    column->flags = 0;
+    if (colon == NULL)
+        return true;
+    StrSlice_t rest = StrSlice_new(colon + 1, spec.size - size_len - 1);
+    for (;;) {
+        const char* comma = memchr(rest.str, ',', rest.size);
+        StrSlice_t flag = StrSlice_new(rest.str, comma != NULL ? (size_t) (comma - rest.str) : rest.size);
+        if (StrSlice_eq(flag, StrSlice_new("hash", 4))) {
+            column->flags |= ColumnHashIndex;
+        } else if (StrSlice_eq(flag, StrSlice_new("ordered", 7))) {
+            column->flags |= ColumnOrderedIndex;
+        } else if (StrSlice_eq(flag, StrSlice_new("columnar", 8))) {
+            column->flags |= ColumnColumnar;
+        } else if (StrSlice_eq(flag, StrSlice_new("bloom", 5))) {
+            column->flags |= ColumnBloom;
+        } else if (StrSlice_eq(flag, StrSlice_new("unique", 6))) {
+            column->flags |= ColumnUnique | ColumnHashIndex;
+        } else {
+            fputs("ERROR: unknown column flag: \"", stderr);
+            StrSlice_fput(flag, stderr);
+            fputs("\" (expected `hash`, `ordered`, `columnar`, `bloom` or `unique`)\n", stderr);
+            return false;
         }
+        if (comma == NULL)
+            return true;
+        rest = StrSlice_new(comma + 1, rest.size - flag.size - 1);
     }
+}
 
-    StrSlice_t refs[database->col_num];
+// Returns false (and complains) if `it` has any arguments left
+bool expect_no_args(ParseArgs_t* it, const char* cmd) {
+    StrSlice_t temp;
+    bool extra = ParseArgs_next(it, &temp) != IterEnd;
+    if (extra)
+        fprintf(stderr, "ERROR: `%s` does not accept arguments. See `help %s`\n", cmd, cmd);
+    return !extra;
+}
 
-    if (ParseArgs_next(&it, &owned[0]) != IterEnd) {
-        fprintf(stderr, "Too many arguments: expected %zu", database->col_num);
+enum Flow add_handler(ParseArgs_t it, Database_t* database) {
+    StrSlice_t values[database->col_num];
+    if (!parse_values(&it, values, database->col_num))
+        return FlowContinue;
+
+    size_t row_idx;
+    if (Database_add(database, values, &row_idx) != AddOk) {
+        ERR("Cannot add entry to database");
+    } else {
+        printf("%zu\n", row_idx);
+    }
+    return FlowContinue;
+}
+
+enum Flow begin_handler(ParseArgs_t it, Database_t* database) {
+    if (!expect_no_args(&it, "begin"))
+        return FlowContinue;
+    if (database->batching) {
+        ERR("Batch is already started");
+        return FlowContinue;
+    }
+    Database_begin(database);
+    return FlowContinue;
+}
+
+enum Flow commit_handler(ParseArgs_t it, Database_t* database) {
+    if (!expect_no_args(&it, "commit"))
+        return FlowContinue;
+    if (!database->batching) {
+        ERR("No batch is started, use `begin`");
+        return FlowContinue;
+    }
+    printf("Committed %zu rows\n", Database_commit(database));
+    return FlowContinue;
+}
+
+enum Flow rollback_handler(ParseArgs_t it, Database_t* database) {
+    if (!expect_no_args(&it, "rollback"))
+        return FlowContinue;
+    if (!database->batching) {
+        ERR("No batch is started, use `begin`");
+        return FlowContinue;
+    }
+    Database_rollback(database);
+    return FlowContinue;
+}
+
+enum Flow sync_handler(ParseArgs_t it, Database_t* database) {
+    if (!expect_no_args(&it, "sync"))
+        return FlowContinue;
+    Database_sync(database);
+    return FlowContinue;
+}
+
+enum Flow import_handler(ParseArgs_t it, Database_t* database) {
+    StrSlice_t filename;
+    String_t line = String_new();
+    StrSlice_t values[database->col_num];
+    // escaped values of single line
+    Arena_t arena = Arena_new();
+    FILE* file = NULL;
+
+    if (ParseArgs_next(&it, &filename) != IterOk || !expect_no_args(&it, "import")) {
+        ERR("`import` accepts exactly one argument: <file>");
+        goto wipeout;
+    }
+    file = fopen(Arena_cstr(it.arena, filename), "rb");
+    if (file == NULL) {
+        ERR("Can't open file for import");
         goto wipeout;
     }
 
-    for (size_t i = 0; i < database->col_num; ++i)
-        refs[i] = String_borrow(&owned[i]);
+    // Inside explicit batch imported rows just join it
+    bool own_batch = !database->batching;
+    size_t savepoint = database->batch.size / database->row_size;
+    Database_begin(database);
+    size_t line_num = 0;
+    bool failed = false;
+    while (!failed && String_getline(&line, file) != -1) {
+        ++line_num;
+        while (line.size > 0 && (line.str[line.size - 1] == '\n' || line.str[line.size - 1] == '\r'))
+            --line.size;
+        if (line.size == 0)
+            continue;
+        Arena_reset(&arena);
+        ParseArgs_t args = ParseArgs_new(String_borrow(&line), &arena);
+        failed = !parse_values(&args, values, database->col_num);
+        size_t row_idx;
+        failed = failed || Database_add(database, values, &row_idx) != AddOk;
+        if (failed)
+            fprintf(stderr, "ERROR: can't import line #%zu, nothing imported\n", line_num);
+    }
 
-    size_t row_idx;
-    if (Database_add(database, refs, &row_idx) != AddOk)
-        ERR("Cannot add entry to database");
+    size_t imported = database->batch.size / database->row_size - savepoint;
+    if (failed) {
+        Database_rollback_to(database, savepoint);
+        if (own_batch)
+            Database_rollback(database);
+    } else if (own_batch) {
+        printf("Imported %zu rows\n", Database_commit(database));
+    } else {
+        printf("Imported %zu rows into batch, `commit` to write them\n", imported);
+    }
 
     wipeout:
-    for (size_t i = 0; i < database->col_num; ++i)
-        String_drop(&owned[i]);
+    if (file != NULL)
+        fclose(file);
+    Arena_drop(&arena);
+    String_drop(&line);
     return FlowContinue;
 }
 
+// Parses `[--format <fmt>] [--offset <idx>] [--limit <num>]` of `cmd`.
+// Returns false (having reported error) if they're wrong
+bool parse_print_options(ParseArgs_t* it, const char* cmd, PrintOptions_t* options) {
+    *options = PRINT_DEFAULTS;
+    StrSlice_t flag;
+    StrSlice_t value;
+    while (ParseArgs_next(it, &flag) == IterOk) {
+        if (ParseArgs_next(it, &value) != IterOk) {
+            fprintf(stderr, "ERROR: `%s` expects value after option. See `help %s`\n", cmd, cmd);
+            return false;
+        }
+        if (StrSlice_eq_str(flag, "--format")) {
+            if (!OutputFormat_parse(value, &options->format)) {
+                ERR("<fmt> must be one of `pipe`, `tsv`, `csv`, `json`");
+                return false;
+            }
+            continue;
+        }
+        ssize_t num = StrSlice_into_decimal(value);
+        if (StrSlice_eq_str(flag, "--offset") && num != -1) {
+            options->offset = num;
+        } else if (StrSlice_eq_str(flag, "--limit") && num != -1) {
+            options->limit = num;
+        } else {
+            fprintf(stderr, "ERROR: wrong option of `%s`. See `help %s`\n", cmd, cmd);
+            return false;
+        }
+    }
+    return true;
+}
+
 enum Flow print_handler(ParseArgs_t it, Database_t* database) {
-    String_t temp = String_new();
+    PrintOptions_t options;
+    if (parse_print_options(&it, "print", &options))
+        Database_print(database, true, &options);
+    return FlowContinue;
+}
+
+enum Flow printall_handler(ParseArgs_t it, Database_t* database) {
+    PrintOptions_t options;
+    if (parse_print_options(&it, "printall", &options))
+        Database_print(database, false, &options);
+    return FlowContinue;
+}
+
+enum Flow find_handler(ParseArgs_t it, Database_t* database) {
+    enum { FindEq, FindPrefix, FindContains, FindRange } mode = FindEq;
+    StrSlice_t col_idx_s;
+    StrSlice_t value;
+    StrSlice_t value_hi;
+    StrSlice_t temp;
+    if (ParseArgs_next(&it, &col_idx_s) != IterOk) {
+        ERR("can't parse first argument (must be <col_idx>, `--prefix`, `--contains` or `--range`)");
+        return FlowContinue;
+    }
+    if (col_idx_s.size > 2 && col_idx_s.str[0] == '-' && col_idx_s.str[1] == '-') {
+        if (StrSlice_eq_str(col_idx_s, "--prefix")) {
+            mode = FindPrefix;
+        } else if (StrSlice_eq_str(col_idx_s, "--contains")) {
+            mode = FindContains;
+        } else if (StrSlice_eq_str(col_idx_s, "--range")) {
+            mode = FindRange;
+        } else {
+            ERR("Unknown `find` mode. See `help find`");
+            return FlowContinue;
+        }
+        if (ParseArgs_next(&it, &col_idx_s) != IterOk) {
+            ERR("can't parse <col_idx>");
+            return FlowContinue;
+        }
+    }
+
+    if (ParseArgs_next(&it, &value) != IterOk) {
+        ERR("can't parse <value>");
+        return FlowContinue;
+    }
+
+    if (mode == FindRange && ParseArgs_next(&it, &value_hi) != IterOk) {
+        ERR("can't parse <hi>");
+        return FlowContinue;
+    }
+
     if (ParseArgs_next(&it, &temp) != IterEnd) {
-        ERR("`print` does not accept arguments. See `help print`");
-        String_drop(&temp);
+        ERR("Too many arguments for `find`. See `help find`");
         return FlowContinue;
     }
-    Database_print(database, true);
+
+    ssize_t col_idx = StrSlice_into_decimal(col_idx_s);
+    if (col_idx == -1 || (size_t) col_idx >= database->col_num) {
+        ERR("<col_idx> must be index of column (see columns list on start)");
+        return FlowContinue;
+    }
+
+    size_t found = 0;
+    switch (mode) {
+        case FindEq:
+            found = Database_find(database, col_idx, value);
+            break;
+        case FindPrefix:
+            found = Database_find_prefix(database, col_idx, value);
+            break;
+        case FindContains:
+            found = Database_find_substr(database, col_idx, value);
+            break;
+        case FindRange:
+            found = Database_find_range(
+                database, col_idx,
+                value, value_hi
+            );
+    }
+    printf("Found %zu entries\n", found);
     return FlowContinue;
 }
 
-enum Flow printall_handler(ParseArgs_t it, Database_t* database) {
-    String_t temp = String_new();
+enum Flow get_handler(ParseArgs_t it, Database_t* database) {
+    StrSlice_t idx_s;
+    StrSlice_t temp;
+    if (ParseArgs_next(&it, &idx_s) != IterOk) {
+        ERR("can't parse first argument (must be <idx>)");
+        return FlowContinue;
+    }
+
     if (ParseArgs_next(&it, &temp) != IterEnd) {
-        ERR("`printall` does not accept arguments. See `help print`");
-        String_drop(&temp);
+        ERR("`get` accepts only one argument. See `help get`");
+        return FlowContinue;
+    }
+
+    ssize_t idx = StrSlice_into_decimal(idx_s);
+    if (idx == -1) {
+        ERR("<idx> must be decimal (unsigned int)");
+        return FlowContinue;
+    }
+
+    switch (Database_get(database, idx)) {
+        case GetOk:
+            break;
+        case GetOutOfBounds:
+            fprintf(stderr, "ERROR: there are only %zu rows\n", database->rows_num);
+            break;
+        case GetWrongSymbol:
+            ERR("Row is broken");
+            break;
+        case GetCrashed:
+            ERR("Writer died in the middle of rewrite. Table is recovered by next command");
+            break;
+    }
+    return FlowContinue;
+}
+
+enum Flow update_handler(ParseArgs_t it, Database_t* database) {
+    StrSlice_t values[3];
+    if (!parse_values(&it, values, 3))
+        return FlowContinue;
+
+    ssize_t idx = StrSlice_into_decimal(values[0]);
+    ssize_t col_idx = StrSlice_into_decimal(values[1]);
+    if (idx == -1 || col_idx == -1) {
+        ERR("<row_idx> and <col_idx> must be decimal (unsigned int)");
         return FlowContinue;
     }
-    Database_print(database, false);
+
+    switch (Database_update(database, idx, col_idx, values[2])) {
+        case UpdateOk:
+            break;
+        case UpdateOutOfBounds:
+            fprintf(stderr, "ERROR: there are only %zu rows\n", database->rows_num);
+            break;
+        case UpdateBadColumn:
+            fprintf(stderr, "ERROR: there are only %zu columns\n", database->col_num);
+            break;
+        case UpdateDead:
+            ERR("Row is deleted, `resurrect` it first");
+            break;
+        case UpdateWrongSymbol:
+            ERR("Row is broken");
+            break;
+        case UpdateFieldOverflow:
+            fprintf(stderr, "ERROR: value is longer than column #%zd (%zu)\n", col_idx, database->columns[col_idx].size);
+            break;
+        case UpdateDuplicate:
+            fprintf(stderr, "ERROR: another row has this value in unique column #%zd\n", col_idx);
+            break;
+    }
     return FlowContinue;
 }
 
 enum Flow delete_handler(ParseArgs_t it, Database_t* database) {
-    String_t idx_s = String_new();
-    String_t temp = String_new();
+    StrSlice_t idx_s;
+    StrSlice_t temp;
     if (ParseArgs_next(&it, &idx_s) != IterOk) {
         ERR("can't parse first argument (must be <idx>)");
-        goto wipeout;
+        return FlowContinue;
     }
 
     if (ParseArgs_next(&it, &temp) != IterEnd) {
         ERR("`delete` accepts only one argument. See `help delete`");
-        goto wipeout;
+        return FlowContinue;
     }
 
-    ssize_t idx = StrSlice_into_decimal(String_borrow(&idx_s));
+    ssize_t idx = StrSlice_into_decimal(idx_s);
     if (idx == -1) {
         ERR("<idx> must be decimal (unsigned int)");
-        goto wipeout;
+        return FlowContinue;
     }
 
-    fflush(database->buffer);
     if (Database_delete(database, idx) != DeleteOk)
         ERR("Cannot delete entry");
-
-    wipeout:
-    String_drop(&temp);
-    String_drop(&idx_s);
     return FlowContinue;
 }
 
 enum Flow resurrect_handler(ParseArgs_t it, Database_t* database) {
-    String_t idx_s = String_new();
-    String_t temp = String_new();
+    StrSlice_t idx_s;
+    StrSlice_t temp;
     if (ParseArgs_next(&it, &idx_s) != IterOk) {
         ERR("can't parse first argument (must be <idx>)");
-        goto wipeout;
+        return FlowContinue;
     }
 
     if (ParseArgs_next(&it, &temp) != IterEnd) {
         ERR("`resurrect` accepts only one argument. See `help resurrect`");
-        goto wipeout;
+        return FlowContinue;
     }
 
-    ssize_t idx = StrSlice_into_decimal(String_borrow(&idx_s));
+    ssize_t idx = StrSlice_into_decimal(idx_s);
     if (idx == -1) {
         ERR("<idx> must be decimal");
-        goto wipeout;
+        return FlowContinue;
     }
 
-    fflush(database->buffer);
-    if (Database_resurrect(database, idx) != DeleteOk)
-        ERR("Cannot resurrect entry");
+    switch (Database_resurrect(database, idx)) {
+        case ResurrectOk:
+            break;
+        case ResurrectDuplicate:
+            ERR("Another row has value of unique column of this one");
+            break;
+        default:
+            ERR("Cannot resurrect entry");
+    }
+    return FlowContinue;
+}
 
-    wipeout:
-    String_drop(&temp);
-    String_drop(&idx_s);
+enum Flow vacuum_handler(ParseArgs_t it, Database_t* database) {
+    StrSlice_t flag;
+    bool keep_remap = false;
+    switch (ParseArgs_next(&it, &flag)) {
+        case IterEnd:
+            break;
+        case IterOk:
+            if (StrSlice_eq_str(flag, "--keep-remap") && expect_no_args(&it, "vacuum")) {
+                keep_remap = true;
+                break;
+            }
+            // fallthrough
+        default:
+            ERR("`vacuum` accepts only `--keep-remap`. See `help vacuum`");
+            return FlowContinue;
+    }
+
+    size_t rows_num = database->rows_num;
+    size_t kept;
+    switch (Database_vacuum(database, keep_remap, &kept)) {
+        case VacuumOk:
+            printf("Kept %zu of %zu rows\n", kept, rows_num);
+            break;
+        case VacuumBatching:
+            ERR("Can't vacuum during batch, `commit` or `rollback` first");
+            break;
+        case VacuumIOErr:
+            ERR("Can't create temporary file for vacuum");
+    }
+    return FlowContinue;
+}
+
+enum Flow remap_handler(ParseArgs_t it, Database_t* database) {
+    StrSlice_t idx_s;
+    if (ParseArgs_next(&it, &idx_s) != IterOk || !expect_no_args(&it, "remap")) {
+        ERR("`remap` accepts exactly one argument: <idx>");
+        return FlowContinue;
+    }
+    ssize_t idx = StrSlice_into_decimal(idx_s);
+    if (idx == -1) {
+        ERR("<idx> must be decimal");
+        return FlowContinue;
+    }
+
+    char* path = Database_sidecar(database, ".remap");
+    size_t new_idx;
+    switch (Remap_lookup(path, idx, &new_idx)) {
+        case RemapOk:
+            printf("%zu\n", new_idx);
+            break;
+        case RemapDeleted:
+            puts("Row was deleted by vacuum");
+            break;
+        case RemapOutOfBounds:
+            ERR("<idx> is out of bounds of translation table");
+            break;
+        case RemapNoTable:
+            ERR("No translation table, use `vacuum --keep-remap`");
+    }
+    free(path);
+    return FlowContinue;
+}
+
+enum Flow migrate_handler(ParseArgs_t it, Database_t* database) {
+    StrSlice_t values[database->col_num];
+    size_t sizes[database->col_num];
+    if (!parse_values(&it, values, database->col_num))
+        return FlowContinue;
+
+    for (size_t i = 0; i < database->col_num; ++i) {
+        ssize_t size = StrSlice_into_decimal(values[i]);
+        if (size <= 0) {
+            ERR("<size> must be positive decimal");
+            return FlowContinue;
+        }
+        sizes[i] = size;
+    }
+
+    size_t row, col;
+    switch (Database_migrate(database, sizes, &row, &col)) {
+        case MigrateOk:
+            printf("Row size is %zu now\n", database->row_size);
+            break;
+        case MigrateBatching:
+            ERR("Can't migrate during batch, `commit` or `rollback` first");
+            break;
+        case MigrateTooWide:
+            ERR("Column is too wide for ordered index (or for binary table)");
+            break;
+        case MigrateOverflow:
+            fprintf(
+                stderr,
+                "ERROR: value of column #%zu in row #%zu doesn't fit into %zu bytes, nothing changed\n",
+                col, row, sizes[col]
+            );
+            break;
+        case MigrateIOErr:
+            ERR("Can't create temporary file for migration");
+    }
     return FlowContinue;
 }
 
+enum Flow create_handler(ParseArgs_t it, Database_t* database) {
+    StrSlice_t name;
+    // column names and sizes, interleaved
+    StrSlice_t args[2 * DATABASE_MAX_COLUMNS + 1];
+    Column_t columns[DATABASE_MAX_COLUMNS];
+    char names[DATABASE_MAX_COLUMNS][DATABASE_NAME_SIZE];
+    size_t args_num = 0;
+    Format_t format = FormatText;
+    IterRes res = ParseArgs_next(&it, &name);
+    if (res == IterOk && StrSlice_eq_str(name, "--binary")) {
+        format = FormatBinary;
+        res = ParseArgs_next(&it, &name);
+    }
+    if (res != IterOk || StrSlice_eq_str(name, "--binary")) {
+        ERR("`create` needs <name>. See `help create`");
+        return FlowContinue;
+    }
+    for (;;) {
+        res = ParseArgs_next(&it, &args[args_num++]);
+        if (res == IterEnd)
+            break;
+        if (res != IterOk) {
+            ERR("Invalid arguments");
+            return FlowContinue;
+        }
+        if (args_num == 2 * DATABASE_MAX_COLUMNS + 1) {
+            fprintf(stderr, "ERROR: table can't have more than %d columns\n", DATABASE_MAX_COLUMNS);
+            return FlowContinue;
+        }
+    }
+    size_t col_num = (args_num - 1) / 2;
+    if (col_num == 0 || (args_num - 1) % 2 != 0) {
+        ERR("Columns must be given as <column> <size> pairs. See `help create`");
+        return FlowContinue;
+    }
+    for (size_t i = 0; i < col_num; ++i) {
+        if (args[2 * i].size >= DATABASE_NAME_SIZE) {
+            fprintf(stderr, "ERROR: column names must be shorter than %d bytes\n", DATABASE_NAME_SIZE);
+            return FlowContinue;
+        }
+        memcpy(names[i], args[2 * i].str, args[2 * i].size);
+        names[i][args[2 * i].size] = '\0';
+        columns[i].name = names[i];
+        if (!parse_column_spec(args[2 * i + 1], &columns[i]))
+            return FlowContinue;
+    }
+    if (database->batching) {
+        ERR("Can't switch table during batch, `commit` or `rollback` first");
+        return FlowContinue;
+    }
+
+    size_t filename_size = name.size + 5;
+    char* filename = Arena_alloc(it.arena, filename_size);
+    snprintf(filename, filename_size, "%.*s.txt", (int) name.size, name.str);
+    switch (Database_create(filename, columns, col_num, format)) {
+        case CreateOk:
+            break;
+        case CreateExists:
+            fprintf(stderr, "ERROR: file `%s` already exists\n", filename);
+            return FlowContinue;
+        case CreateBadColumns:
+            ERR("Invalid columns (sizes of binary table's columns must be below 65536)");
+            return FlowContinue;
+        case CreateIOErr:
+            fprintf(stderr, "ERROR: can't create file `%s`\n", filename);
+            return FlowContinue;
+    }
+    Database_t created = Database_new(filename, NULL, 0);
+    if (created.fd == -1) {
+        Database_drop(&created);
+        ERR("Can't open created table");
+        return FlowContinue;
+    }
+    // cache is setting of process, not of table
+    Database_set_cache(&created, database->cache);
+    database->cache = NULL;
+    Database_drop(database);
+    *database = created;
+    Database_overview(database);
+    return FlowContinue;
+}
+
+enum Flow copy_handler(ParseArgs_t it, Database_t* database) {
+    StrSlice_t path;
+    if (ParseArgs_next(&it, &path) != IterOk || !expect_no_args(&it, "copy")) {
+        ERR("`copy` accepts exactly one argument: <file>");
+        return FlowContinue;
+    }
+    size_t added;
+    switch (Database_copy(database, Arena_cstr(it.arena, path), &added)) {
+        case CopyOk:
+            printf("Copied %zu rows\n", added);
+            break;
+        case CopyCantOpen:
+            ERR("Can't open table to copy from");
+            break;
+        case CopySameTable:
+            ERR("Can't copy table into itself");
+            break;
+        case CopyColumnsMismatch:
+            ERR("Tables have different number of columns");
+            break;
+        case CopyOverflow:
+        case CopyDuplicate:
+            ERR("Nothing is copied");
+    }
+    return FlowContinue;
+}
+
+enum Flow export_handler(ParseArgs_t it, Database_t* database) {
+    StrSlice_t path;
+    Format_t format = database->format;
+    IterRes res = ParseArgs_next(&it, &path);
+    if (res == IterOk && path.size > 2 && path.str[0] == '-' && path.str[1] == '-') {
+        if (StrSlice_eq_str(path, "--binary")) {
+            format = FormatBinary;
+        } else if (StrSlice_eq_str(path, "--text")) {
+            format = FormatText;
+        } else {
+            ERR("`export` accepts only `--text` or `--binary`. See `help export`");
+            return FlowContinue;
+        }
+        res = ParseArgs_next(&it, &path);
+    }
+    if (res != IterOk || !expect_no_args(&it, "export")) {
+        ERR("`export` needs exactly one <file>. See `help export`");
+        return FlowContinue;
+    }
+    switch (Database_export(database, Arena_cstr(it.arena, path), format)) {
+        case ExportOk:
+            printf(
+                "Exported %zu rows (and %zu deleted ones)\n",
+                database->alive_num,
+                database->rows_num - database->alive_num
+            );
+            break;
+        case ExportTooWide:
+            ERR("Column is too wide for binary table");
+            break;
+        case ExportIOErr:
+            ERR("Can't create file (it must not exist)");
+            break;
+        case ExportCrashed:
+            ERR("Writer died in the middle of rewrite. Table is recovered by next command");
+    }
+    return FlowContinue;
+}
+
+enum Flow cache_handler(ParseArgs_t it, Database_t* database) {
+    if (!expect_no_args(&it, "cache"))
+        return FlowContinue;
+    const PageCache_t* cache = database->cache;
+    if (cache == NULL) {
+        puts("Page cache is off, run with `--cache-mb <size>` to turn it on");
+        return FlowContinue;
+    }
+    size_t lookups = cache->hits + cache->misses;
+    printf(
+        "Pages: %zu of %zu (%zu bytes each)\n"
+        "Hits: %zu, misses: %zu (%.1f%% hit rate)\n"
+        "Evictions: %zu, write-backs: %zu\n",
+        cache->used, cache->capacity, cache->page_size,
+        cache->hits, cache->misses, lookups != 0 ? 100.0 * cache->hits / lookups : 0.0,
+        cache->evictions, cache->writebacks
+    );
+    return FlowContinue;
+}
+
+// Runs single command `line` (without trailing \n) as typed into shell,
+// its arguments live in `arena`, which is reset afterwards. Output of
+// `interactive` command is followed by empty line. `served` command came
+// from client of `--serve`d table
+enum Flow run_command(StrSlice_t line, Database_t* database, Arena_t* arena, bool interactive, bool served) {
+    ParseArgs_t it = ParseArgs_new(line, arena);
+    StrSlice_t word;
+    enum Flow flow = FlowContinue;
+    switch (ParseArgs_next(&it, &word)) {
+        case IterEnd:
+            puts("Use `help [cmd]` for help on specific command or in general\n");
+            goto wipeout;
+        case IterSingleErr:
+        case IterTotalErr:
+            puts("Can't parse as valid arguments");
+            puts("Use `help [cmd]` for help on specific command or in general\n");
+            goto wipeout;
+        case IterOk:
+            ;
+    }
+    enum Command cmd = Command_lookup(word);
+    if (cmd == CommandUnknown) {
+        puts("Unknown command. For list of commands use `help`\n");
+        goto wipeout;
+    }
+    if (served && handlers[cmd].switches) {
+        fprintf(stderr, "ERROR: `%s` would switch table of every client, it can't be run over socket\n\n", handlers[cmd].pattern);
+        goto wipeout;
+    }
+    // rows published by writer since previous command
+    Database_refresh(database);
+    if (handlers[cmd].writes && !Database_writable(database)) {
+        fprintf(
+            stderr,
+            "ERROR: table is written by another process (pid %llu), try again later\n\n",
+            (unsigned long long) TableLock_writer(&database->lock)
+        );
+        goto wipeout;
+    }
+    flow = handlers[cmd].handler(it, database);
+    if (interactive)
+        putchar('\n');
+
+    wipeout:
+    // unescaped arguments of this command
+    Arena_reset(arena);
+    return flow;
+}
+
 #endif
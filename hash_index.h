@@ -0,0 +1,137 @@
+#ifndef __HASH_INDEX_H__
+#define __HASH_INDEX_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "iterator.h"
+#include "my_string.h"
+#include "utils.h"
+
+// Open addressing (linear probing) multimap: hash of value -> row index.
+// Values themselves aren't stored: rows are fixed-width and addressable,
+// so caller compares candidate row against looked up value itself
+
+typedef struct {
+    uint64_t hash;
+    // row index + 1, 0 marks empty entry
+    size_t row;
+} HashIndexEntry_t;
+
+typedef struct {
+    HashIndexEntry_t* entries;
+    // always power of 2 (or 0)
+    size_t capacity;
+    size_t size;
+} HashIndex_t;
+
+typedef struct {
+    const HashIndex_t* index;
+    uint64_t hash;
+    size_t pos;
+} HashIndexIter_t;
+
+// FNV-1a
+uint64_t StrSlice_hash(StrSlice_t slice) {
+    uint64_t res = 14695981039346656037ULL;
+    for (size_t i = 0; i < slice.size; ++i) {
+        res ^= (unsigned char) slice.str[i];
+        res *= 1099511628211ULL;
+    }
+    return res;
+}
+
+HashIndex_t HashIndex_new(void) {
+    HashIndex_t res = { NULL, 0, 0 };
+    return res;
+}
+
+void HashIndex_drop(HashIndex_t* self) {
+    free(self->entries);
+    self->entries = NULL;
+    self->capacity = self->size = 0;
+}
+
+void HashIndex_insert(HashIndex_t* self, uint64_t hash, size_t row);
+
+// Keeps load factor at most 1/2
+void HashIndex_reserve(HashIndex_t* self, size_t size) {
+    if (size * 2 <= self->capacity)
+        return;
+    size_t capacity = self->capacity == 0 ? 64 : self->capacity;
+    while (size * 2 > capacity)
+        capacity *= 2;
+    HashIndex_t old = *self;
+    self->entries = calloc(capacity, sizeof(HashIndexEntry_t));
+    ANZ(self->entries, "Allocation failed");
+    self->capacity = capacity;
+    self->size = 0;
+    for (size_t i = 0; i < old.capacity; ++i)
+        if (old.entries[i].row != 0)
+            HashIndex_insert(self, old.entries[i].hash, old.entries[i].row - 1);
+    free(old.entries);
+}
+
+void HashIndex_insert(HashIndex_t* self, uint64_t hash, size_t row) {
+    HashIndex_reserve(self, self->size + 1);
+    size_t mask = self->capacity - 1;
+    size_t pos = hash & mask;
+    while (self->entries[pos].row != 0)
+        pos = (pos + 1) & mask;
+    self->entries[pos].hash = hash;
+    self->entries[pos].row = row + 1;
+    ++self->size;
+}
+
+// Removes entry (hash, row) if present. Uses backward shift instead of
+// tombstones, so that probe sequences never degrade
+void HashIndex_remove(HashIndex_t* self, uint64_t hash, size_t row) {
+    if (self->capacity == 0)
+        return;
+    size_t mask = self->capacity - 1;
+    size_t pos = hash & mask;
+    for (;; pos = (pos + 1) & mask) {
+        if (self->entries[pos].row == 0)
+            return;
+        if (self->entries[pos].hash == hash && self->entries[pos].row == row + 1)
+            break;
+    }
+    size_t hole = pos;
+    for (pos = (pos + 1) & mask; self->entries[pos].row != 0; pos = (pos + 1) & mask) {
+        size_t home = self->entries[pos].hash & mask;
+        // entry may move into hole only if hole lies between its home
+        // and its current position (cyclically)
+        if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+            self->entries[hole] = self->entries[pos];
+            hole = pos;
+        }
+    }
+    self->entries[hole].row = 0;
+    --self->size;
+}
+
+HashIndexIter_t HashIndexIter_new(const HashIndex_t* index, uint64_t hash) {
+    HashIndexIter_t res = { index, hash, index->capacity == 0 ? 0 : hash & (index->capacity - 1) };
+    return res;
+}
+
+// Yields rows whose value has the same hash (candidates, not matches)
+IterRes HashIndexIter_next(HashIndexIter_t* self, size_t* row) {
+    if (self->index->capacity == 0)
+        return IterEnd;
+    size_t mask = self->index->capacity - 1;
+    for (;;) {
+        const HashIndexEntry_t* entry = &self->index->entries[self->pos];
+        if (entry->row == 0)
+            return IterEnd;
+        self->pos = (self->pos + 1) & mask;
+        if (entry->hash == self->hash) {
+            *row = entry->row - 1;
+            return IterOk;
+        }
+    }
+}
+
+#endif
@@ -1,23 +1,94 @@
+// for sync_file_range()
+#define _GNU_SOURCE
+
+#include <fcntl.h>
 #include <locale.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
+#include "arena.h"
 #include "database.h"
 #include "handlers.h"
+#include "script.h"
+#include "server.h"
 #include "utils.h"
 
-int main(void) {
+void usage(const char* name) {
+    fprintf(
+        stderr,
+        "Usage: %s [-f <script> | --serve <socket> | --connect <socket>] [--cache-mb <size>]\n"
+        "  -f <script>         run commands from file (stdin which is not terminal\n"
+        "                      is run the same way)\n"
+        "  --serve <socket>    keep table open and run commands sent to Unix socket\n"
+        "  --connect <socket>  shell for table served by `--serve`\n"
+        "  --cache-mb <size>   keep at most <size> MiB of table mapped for row\n"
+        "                      lookups (`get`, `update`, indexed `find`...)\n",
+        name
+    );
+}
+
+int main(int argc, char** argv) {
     setlocale(0, "");
 
+    const char* script_path = NULL;
+    const char* serve_path = NULL;
+    const char* connect_path = NULL;
+    size_t cache_mb = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            script_path = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_path = argv[++i];
+        } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            connect_path = argv[++i];
+        } else if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc) {
+            char* end;
+            cache_mb = strtoul(argv[++i], &end, 10);
+            if (*end != '\0' || cache_mb == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ((script_path != NULL) + (serve_path != NULL) + (connect_path != NULL) > 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (connect_path != NULL)
+        return Client_run(connect_path);
+
     int ret_stat = 0;
     String_t line = String_new();
-    String_t word = String_new();
+    // arguments of command being run
+    Arena_t arena = Arena_new();
+    Script_t script = Script_new();
+    bool batch = serve_path == NULL && (script_path != NULL || !isatty(STDIN_FILENO));
+    if (batch) {
+        static char output[SCRIPT_OUTPUT_BUFFER];
+        setvbuf(stdout, output, _IOFBF, sizeof(output));
+        int fd = script_path != NULL ? open(script_path, O_RDONLY) : STDIN_FILENO;
+        bool script_ok = fd != -1 && Script_read(&script, fd);
+        if (fd != -1 && script_path != NULL)
+            close(fd);
+        if (!script_ok) {
+            fprintf(stderr, "ERROR: can't read script `%s`\n", script_path != NULL ? script_path : "<stdin>");
+            Script_drop(&script);
+            return 1;
+        }
+    }
 
+    // Schema for empty (or headerless) file, otherwise it's read from file
     Column_t columns[] = {
-        {32, "fio"},
+        {32, "fio", ColumnOrderedIndex},
         /*{64, "department"},
         {32, "position"},
         {16, "home_address"},*/
-        {16, "phone_number"},
+        {16, "phone_number", ColumnHashIndex | ColumnOrderedIndex | ColumnColumnar | ColumnBloom},
         // {128, "courses"}
     };
     Database_t database = Database_new(
@@ -25,13 +96,32 @@ int main(void) {
         columns,
         sizeof(columns) / sizeof(Column_t)
     );
-    if (database.buffer == NULL) {
+    if (database.fd == -1) {
         ERR("Problem opening database file");
         ret_stat = 1;
         goto wipeout;
     }
+    if (cache_mb != 0)
+        Database_set_cache(&database, PageCache_new(cache_mb << 20));
+    if (batch) {
+        for (size_t i = 0; i < script.lines.size; ++i)
+            if (run_command(Script_line(&script, i), &database, &arena, false, false) == FlowExit)
+                break;
+        goto wipeout;
+    }
     Database_overview(&database);
 
+    if (serve_path != NULL) {
+        Server_t server;
+        if (!Server_open(&server, serve_path, &database)) {
+            ret_stat = 1;
+            goto wipeout;
+        }
+        Server_loop(&server);
+        Server_close(&server);
+        goto wipeout;
+    }
+
     for (;;) {
         fputs("$ ", stdout);
         fflush(stdout);
@@ -41,46 +131,14 @@ int main(void) {
             goto wipeout;
         }
         --line.size; // cut off last \n
-        ParseArgs_t it = { String_borrow(&line) };
-        int flow = 0;
-        switch (ParseArgs_next(&it, &word)) {
-            case IterEnd:
-                puts("Use `help [cmd]` for help on specific command or in general\n");
-                flow = 1;
-                break;
-            case IterSingleErr:
-            case IterTotalErr:
-                puts("Can't parse as valid arguments");
-                puts("Use `help [cmd]` for help on specific command or in general\n");
-                flow = 1;
-                break;
-            case IterOk:
-                ;
-        }
-        if (flow == 1)
-            continue;
-        size_t i = 0;
-        for (; i < handlers_num; ++i)
-            if (strlen(handlers[i].pattern) == word.size
-                && memcmp(handlers[i].pattern, word.str, word.size) == 0)
-            {
-                enum Flow flow = handlers[i].handler(it, &database);
-                putchar('\n');
-                switch (flow) {
-                    case FlowExit:
-                        goto wipeout;
-                    default:
-                        ;
-                }
-                break;
-            }
-        if (i == handlers_num)
-            puts("Unknown command. For list of commands use `help`\n");
+        if (run_command(String_borrow(&line), &database, &arena, true, false) == FlowExit)
+            goto wipeout;
     }
 
     wipeout:
     Database_drop(&database);
     String_drop(&line);
-    String_drop(&word);
+    Arena_drop(&arena);
+    Script_drop(&script);
     return ret_stat;
 }
@@ -0,0 +1,112 @@
+#ifndef __MIGRATE_H__
+#define __MIGRATE_H__
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "database.h"
+#include "fs_fallible.h"
+#include "table_writer.h"
+#include "utils.h"
+
+// Progress is reported every this many bytes of source table
+#define MIGRATE_REPORT_EVERY ((size_t) 256 << 20)
+
+typedef enum { MigrateOk, MigrateBatching, MigrateTooWide, MigrateOverflow, MigrateIOErr } MigrateStatus_t;
+
+void migrate_report(const char* what, size_t done, size_t total, const struct timespec* start) {
+    double elapsed = seconds_since(start);
+    fprintf(
+        stderr,
+        "%s: %.1f / %.1f MiB, %.1f s, %.1f MiB/s\n",
+        what,
+        done / 1048576.0, total / 1048576.0,
+        elapsed,
+        elapsed > 0 ? done / 1048576.0 / elapsed : 0.0
+    );
+}
+
+// Rewrites table in single streaming pass so that column #i has size
+// `sizes[i]`. Row indices and deleted flags are preserved. New table is
+// built in `<filename>.migrate`, synced and renamed over old one; if any
+// value doesn't fit into its new size nothing is changed
+// (`overflow_row` and `overflow_col` tell which value is in the way).
+// Database is reopened with new columns (taken from new header) afterwards
+MigrateStatus_t Database_migrate(Database_t* self, const size_t* sizes, size_t* overflow_row, size_t* overflow_col) {
+    if (self->batching)
+        return MigrateBatching;
+    Column_t columns[self->col_num];
+    memcpy(columns, self->columns, sizeof(columns));
+    for (size_t col_idx = 0; col_idx < self->col_num; ++col_idx) {
+        columns[col_idx].size = sizes[col_idx];
+        if (
+            ((columns[col_idx].flags & ColumnOrderedIndex) && !BTree_key_size_ok(sizes[col_idx]))
+            || (self->format == FormatBinary && sizes[col_idx] > UINT16_MAX)
+        )
+            return MigrateTooWide;
+    }
+    Database_t layout = Database_layout(columns, self->col_num, self->format);
+    char* tmp_path = Database_sidecar(self, ".migrate");
+    TableWriter_t writer;
+    if (!TableWriter_new(&writer, &layout, tmp_path, O_TRUNC)) {
+        Database_drop(&layout);
+        free(tmp_path);
+        return MigrateIOErr;
+    }
+    madvise(self->map, self->map_size, MADV_SEQUENTIAL);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t total = self->rows_num * self->row_size;
+    size_t next_report = MIGRATE_REPORT_EVERY;
+    StrSlice_t vals[self->col_num];
+    MigrateStatus_t res = MigrateOk;
+    for (size_t idx = 0; idx < self->rows_num; ++idx) {
+        bool alive;
+        if (Database_check_row(self, idx, &alive) != IterOk) {
+            // keep row as deleted, so that indices of others don't move
+            alive = false;
+        }
+        for (size_t col_idx = 0; col_idx < self->col_num; ++col_idx) {
+            vals[col_idx] = Database_field(self, idx, col_idx);
+            if (vals[col_idx].size > sizes[col_idx]) {
+                *overflow_row = idx;
+                *overflow_col = col_idx;
+                res = MigrateOverflow;
+                goto wipeout;
+            }
+        }
+        TableWriter_push(&writer, vals, alive);
+        Database_release_behind(self, idx);
+        if ((idx + 1) * self->row_size >= next_report) {
+            migrate_report("migrate", (idx + 1) * self->row_size, total, &start);
+            next_report += MIGRATE_REPORT_EVERY;
+        }
+    }
+    TableWriter_finish(&writer);
+    migrate_report("migrated", total, total, &start);
+
+    wipeout:
+    Database_drop(&layout);
+    if (res == MigrateOk) {
+        // log must not outlive table it was written for
+        Wal_sync(self->wal, true);
+        if (rename(tmp_path, self->filename)) { FATAL("Can't rename migrated table over old one"); }
+        fsync_parent(self->filename);
+        Database_reopen(self);
+    } else {
+        TableWriter_abort(&writer, tmp_path);
+        Database_release(self, 0, self->rows_num);
+    }
+    free(tmp_path);
+    return res;
+}
+
+#endif
@@ -53,7 +53,10 @@ void String_drop(String_t* self) {
 void String_extend_with_StrSlice(String_t* self, struct StrSlice slice) {
     // size_t self_len = strlen(*self);
     if (self->capacity < self->size + slice.size) {
-        self->capacity = self->size + slice.size;
+        // grow geometrically, so that sequence of extends is linear
+        self->capacity = self->capacity * 2 > self->size + slice.size
+            ? self->capacity * 2
+            : self->size + slice.size;
         self->str = (char*) realloc(self->str, self->capacity);
         ANZ(self->str, "Allocation failed");
     }
@@ -114,10 +117,9 @@ StrSlice_t StrSlice_from_raw(const char* str) {
 }
 
 void StrSlice_fput(StrSlice_t self, FILE* stream) {
-    for (size_t i = 0; i < self.size; ++i)
-        if (fputc(*self.str++, stream) == EOF) {
-            FATAL("fputc() == EOF");
-        }
+    if (fwrite(self.str, 1, self.size, stream) != self.size) {
+        FATAL("fwrite() failed");
+    }
 }
 
 void StrSlice_to_String(StrSlice_t self, String_t* res) {
@@ -143,6 +145,10 @@ bool StrSlice_eq_str(StrSlice_t self, const char* str) {
         && memcmp(self.str, str, self.size) == 0;
 }
 
+bool StrSlice_eq(StrSlice_t self, StrSlice_t other) {
+    return self.size == other.size && memcmp(self.str, other.str, self.size) == 0;
+}
+
 StrSlice_t StrSlice_rstrip(StrSlice_t slice, char sym) {
     while (slice.size > 0 && slice.str[slice.size - 1] == sym)
         --slice.size;
@@ -0,0 +1,231 @@
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "fs_fallible.h"
+#include "my_string.h"
+#include "utils.h"
+
+// Rows shown by `print` are formatted whole into String_t's (integers are
+// formatted by hand, no stdio involved), which are then written to stdout
+// by single writev
+
+// limits.h has it only for X/Open, this is its Linux value
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+typedef enum { OutputPipe, OutputTsv, OutputCsv, OutputJson } OutputFormat_t;
+
+static const char* const output_format_names[] = { "pipe", "tsv", "csv", "json" };
+
+// Returns false if `name` is not name of format
+bool OutputFormat_parse(StrSlice_t name, OutputFormat_t* format) {
+    for (size_t i = 0; i < sizeof(output_format_names) / sizeof(output_format_names[0]); ++i)
+        if (StrSlice_eq_str(name, output_format_names[i])) {
+            *format = i;
+            return true;
+        }
+    return false;
+}
+
+void Output_char(String_t* out, char sym) {
+    String_extend_with_StrSlice(out, StrSlice_new(&sym, 1));
+}
+
+void Output_u64(String_t* out, uint64_t value) {
+    char digits[20];
+    size_t pos = sizeof(digits);
+    do {
+        digits[--pos] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    String_extend_with_StrSlice(out, StrSlice_new(digits + pos, sizeof(digits) - pos));
+}
+
+// Value of TSV field: tab, newline and backslash are escaped with backslash
+void output_tsv(String_t* out, StrSlice_t value) {
+    size_t plain = 0;
+    for (size_t i = 0; i < value.size; ++i) {
+        const char* escaped;
+        switch (value.str[i]) {
+            case '\t': escaped = "\\t"; break;
+            case '\n': escaped = "\\n"; break;
+            case '\r': escaped = "\\r"; break;
+            case '\\': escaped = "\\\\"; break;
+            default: continue;
+        }
+        String_extend_with_StrSlice(out, StrSlice_new(value.str + plain, i - plain));
+        String_extend_with_StrSlice(out, StrSlice_new(escaped, 2));
+        plain = i + 1;
+    }
+    String_extend_with_StrSlice(out, StrSlice_new(value.str + plain, value.size - plain));
+}
+
+// Value of CSV field (RFC 4180): quoted if it has comma, quote or newline
+void output_csv(String_t* out, StrSlice_t value) {
+    bool quoted = false;
+    for (size_t i = 0; !quoted && i < value.size; ++i)
+        quoted = value.str[i] == ',' || value.str[i] == '"' || value.str[i] == '\n' || value.str[i] == '\r';
+    if (!quoted) {
+        String_extend_with_StrSlice(out, value);
+        return;
+    }
+    Output_char(out, '"');
+    size_t plain = 0;
+    for (size_t i = 0; i < value.size; ++i)
+        if (value.str[i] == '"') {
+            // quote is doubled
+            String_extend_with_StrSlice(out, StrSlice_new(value.str + plain, i + 1 - plain));
+            plain = i;
+        }
+    String_extend_with_StrSlice(out, StrSlice_new(value.str + plain, value.size - plain));
+    Output_char(out, '"');
+}
+
+// JSON string: bytes above 0x7F are passed as is (values are taken to be
+// UTF-8)
+void output_json(String_t* out, StrSlice_t value) {
+    static const char hex[] = "0123456789abcdef";
+    Output_char(out, '"');
+    size_t plain = 0;
+    for (size_t i = 0; i < value.size; ++i) {
+        unsigned char sym = value.str[i];
+        if (sym >= 0x20 && sym != '"' && sym != '\\')
+            continue;
+        String_extend_with_StrSlice(out, StrSlice_new(value.str + plain, i - plain));
+        char escaped[6] = { '\\', sym, 0 };
+        size_t size = 2;
+        switch (sym) {
+            case '"':
+            case '\\':
+                break;
+            case '\n': escaped[1] = 'n'; break;
+            case '\r': escaped[1] = 'r'; break;
+            case '\t': escaped[1] = 't'; break;
+            default:
+                escaped[1] = 'u';
+                escaped[2] = '0';
+                escaped[3] = '0';
+                escaped[4] = hex[sym >> 4];
+                escaped[5] = hex[sym & 0xF];
+                size = 6;
+        }
+        String_extend_with_StrSlice(out, StrSlice_new(escaped, size));
+        plain = i + 1;
+    }
+    String_extend_with_StrSlice(out, StrSlice_new(value.str + plain, value.size - plain));
+    Output_char(out, '"');
+}
+
+// Line naming columns for TSV and CSV, nothing for other formats
+void Output_header(String_t* out, OutputFormat_t format, const char* const* names, size_t col_num, bool show_alive) {
+    if (format != OutputTsv && format != OutputCsv)
+        return;
+    char separator = format == OutputTsv ? '\t' : ',';
+    String_extend_with_str(out, "idx");
+    if (show_alive) {
+        Output_char(out, separator);
+        String_extend_with_str(out, "alive");
+    }
+    for (size_t i = 0; i < col_num; ++i) {
+        Output_char(out, separator);
+        if (format == OutputTsv)
+            output_tsv(out, StrSlice_from_raw(names[i]));
+        else
+            output_csv(out, StrSlice_from_raw(names[i]));
+    }
+    Output_char(out, '\n');
+}
+
+// Appends row #idx with given `values`, its `alive` flag is shown only
+// if `show_alive`. Pipe format is the one shell always used:
+// `idx | + | value1 | value2`
+void Output_row(
+    String_t* out, OutputFormat_t format, const char* const* names, size_t col_num,
+    size_t idx, bool show_alive, bool alive, const StrSlice_t* values
+) {
+    switch (format) {
+        case OutputPipe:
+            Output_u64(out, idx);
+            if (show_alive)
+                String_extend_with_StrSlice(out, StrSlice_new(alive ? " | +" : " | -", 4));
+            for (size_t i = 0; i < col_num; ++i) {
+                String_extend_with_StrSlice(out, StrSlice_new(" | ", 3));
+                String_extend_with_StrSlice(out, values[i]);
+            }
+            break;
+        case OutputTsv:
+        case OutputCsv: {
+            char separator = format == OutputTsv ? '\t' : ',';
+            Output_u64(out, idx);
+            if (show_alive) {
+                Output_char(out, separator);
+                Output_char(out, alive ? '+' : '-');
+            }
+            for (size_t i = 0; i < col_num; ++i) {
+                Output_char(out, separator);
+                if (format == OutputTsv)
+                    output_tsv(out, values[i]);
+                else
+                    output_csv(out, values[i]);
+            }
+            break;
+        }
+        case OutputJson:
+            String_extend_with_str(out, "{\"idx\":");
+            Output_u64(out, idx);
+            if (show_alive)
+                String_extend_with_str(out, alive ? ",\"alive\":true" : ",\"alive\":false");
+            for (size_t i = 0; i < col_num; ++i) {
+                Output_char(out, ',');
+                output_json(out, StrSlice_from_raw(names[i]));
+                Output_char(out, ':');
+                output_json(out, values[i]);
+            }
+            Output_char(out, '}');
+    }
+    Output_char(out, '\n');
+}
+
+// Writes `parts` to stdout: straight into its fd by writev (after what
+// stdio has buffered), or through stdio if stream has no fd (server
+// captures output in memory)
+void Output_write(const StrSlice_t* parts, size_t parts_num) {
+    int fd = fileno(stdout);
+    if (fd == -1 || parts_num == 0) {
+        for (size_t i = 0; i < parts_num; ++i)
+            StrSlice_fput(parts[i], stdout);
+        return;
+    }
+    fflush_(stdout);
+    struct iovec iov[parts_num];
+    for (size_t i = 0; i < parts_num; ++i) {
+        iov[i].iov_base = (char*) parts[i].str;
+        iov[i].iov_len = parts[i].size;
+    }
+    for (size_t first = 0; first < parts_num;) {
+        ssize_t res = writev(fd, iov + first, parts_num - first < IOV_MAX ? parts_num - first : IOV_MAX);
+        if (res == -1) {
+            if (errno == EINTR)
+                continue;
+            FATAL("writev() failed");
+        }
+        for (; first < parts_num && (size_t) res >= iov[first].iov_len; ++first)
+            res -= iov[first].iov_len;
+        if (first < parts_num) {
+            iov[first].iov_base = (char*) iov[first].iov_base + res;
+            iov[first].iov_len -= res;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef __PAGE_CACHE_H__
+#define __PAGE_CACHE_H__
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+// Bounded set of pages of table mapping which row lookups (`get`,
+// `update`, indexed `find`, `add`, `delete`) keep resident. Table is
+// mapped whole, so page in set is read and written in place, without
+// syscalls or faults; page missing from set is faulted in and takes slot
+// of page chosen by CLOCK, which is dropped from mapping (and, if it was
+// written, handed to kernel for write-back). So lookups keep at most
+// `capacity` pages mapped, however skewed or scattered they are. Full
+// scans pread rows into own buffers and don't go through it; bulk paths
+// (commit of batch, rebuild of filter, `vacuum`, `migrate`, `export`) go
+// through mapping directly and give pages they've used back with
+// `PageCache_release`
+
+enum PageCacheFlags {
+    PageReferenced = 1,
+    PageDirty = 2
+};
+
+typedef struct {
+    // of mapping being cached
+    char* map;
+    int fd;
+    size_t page_size;
+    // number of pages of mapping
+    size_t pages_num;
+    // slot + 1 of every page of mapping, 0 for page not in cache
+    uint32_t* slot_of;
+    // page held by every slot
+    size_t* pages;
+    unsigned char* flags;
+    size_t capacity;
+    size_t used;
+    // CLOCK hand: next slot to check for eviction
+    size_t hand;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t writebacks;
+} PageCache_t;
+
+// Cache of at most `budget` bytes (at least one page), attached to no
+// mapping. Freed by `PageCache_drop`
+PageCache_t* PageCache_new(size_t budget) {
+    PageCache_t* self = calloc(1, sizeof(PageCache_t));
+    ANZ(self, "Allocation failed");
+    self->fd = -1;
+    self->page_size = sysconf(_SC_PAGESIZE);
+    self->capacity = budget / self->page_size;
+    if (self->capacity == 0)
+        self->capacity = 1;
+    // slot + 1 must fit into `slot_of`
+    if (self->capacity >= UINT32_MAX)
+        self->capacity = UINT32_MAX - 1;
+    self->pages = malloc(self->capacity * sizeof(size_t));
+    ANZ(self->pages, "Allocation failed");
+    self->flags = malloc(self->capacity);
+    ANZ(self->flags, "Allocation failed");
+    return self;
+}
+
+void PageCache_drop(PageCache_t* self) {
+    if (self == NULL)
+        return;
+    free(self->slot_of);
+    free(self->pages);
+    free(self->flags);
+    free(self);
+}
+
+// Starts caching (new) mapping `map` of `size` bytes of file `fd`
+// from scratch: all its pages are dropped, so only pages touched since
+// are kept. Counters go on
+void PageCache_attach(PageCache_t* self, char* map, size_t size, int fd) {
+    if (madvise(map, size, MADV_DONTNEED)) { FATAL("madvise() failed"); }
+    self->map = map;
+    self->fd = fd;
+    self->pages_num = (size + self->page_size - 1) / self->page_size;
+    free(self->slot_of);
+    self->slot_of = calloc(self->pages_num, sizeof(uint32_t));
+    ANZ(self->slot_of, "Allocation failed");
+    self->used = 0;
+    self->hand = 0;
+}
+
+// Frees slot of page not referenced since hand passed it last time
+size_t PageCache_evict(PageCache_t* self) {
+    while (self->flags[self->hand] & PageReferenced) {
+        self->flags[self->hand] &= ~PageReferenced;
+        self->hand = (self->hand + 1) % self->capacity;
+    }
+    size_t slot = self->hand;
+    self->hand = (self->hand + 1) % self->capacity;
+    size_t page = self->pages[slot];
+    size_t offset = page * self->page_size;
+    // mapping of file keeps no data of its own: page stays in kernel's
+    // cache (with its changes), it's only unmapped
+    if (madvise(self->map + offset, self->page_size, MADV_DONTNEED)) { FATAL("madvise() failed"); }
+    if (self->flags[slot] & PageDirty) {
+        // starts write-back of page without waiting for it; page stays
+        // in kernel's cache, so its next lookup is a minor fault
+        if (sync_file_range(self->fd, offset, self->page_size, SYNC_FILE_RANGE_WRITE)) {
+            FATAL("sync_file_range() failed");
+        }
+        ++self->writebacks;
+    }
+    self->slot_of[page] = 0;
+    ++self->evictions;
+    return slot;
+}
+
+void PageCache_touch_page(PageCache_t* self, size_t page, bool dirty) {
+    unsigned char flags = PageReferenced | (dirty ? PageDirty : 0);
+    uint32_t slot = self->slot_of[page];
+    if (slot != 0) {
+        ++self->hits;
+        self->flags[slot - 1] |= flags;
+        return;
+    }
+    ++self->misses;
+    size_t free_slot = self->used < self->capacity ? self->used++ : PageCache_evict(self);
+    self->pages[free_slot] = page;
+    self->flags[free_slot] = flags;
+    self->slot_of[page] = free_slot + 1;
+}
+
+// Marks bytes [`offset`, `offset` + `size`) of mapping as used (and
+// written if `dirty`), bringing their pages into cache
+void PageCache_touch(PageCache_t* self, size_t offset, size_t size, bool dirty) {
+    size_t last = (offset + size - 1) / self->page_size;
+    for (size_t page = offset / self->page_size; page <= last; ++page)
+        PageCache_touch_page(self, page, dirty);
+}
+
+// Drops pages of bytes [`offset`, `offset` + `size`) of mapping which
+// aren't in cache (as they were brought in past it), keeping the rest
+void PageCache_release(PageCache_t* self, size_t offset, size_t size) {
+    if (size == 0)
+        return;
+    size_t end = (offset + size - 1) / self->page_size + 1;
+    size_t page = offset / self->page_size;
+    while (page < end) {
+        if (self->slot_of[page] != 0) {
+            ++page;
+            continue;
+        }
+        size_t first = page;
+        while (page < end && self->slot_of[page] == 0)
+            ++page;
+        if (madvise(self->map + first * self->page_size, (page - first) * self->page_size, MADV_DONTNEED)) {
+            FATAL("madvise() failed");
+        }
+    }
+}
+
+#endif
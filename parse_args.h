@@ -1,78 +1,79 @@
 #ifndef __PARSE_ARGS_H__
 #define __PARSE_ARGS_H__
 
+#include "arena.h"
 #include "iterator.h"
 #include "my_string.h"
 #include "utils.h"
 
 // ParseArgs: ` arg1   "ar\"g\\2"` -> [`arg1`, `ar"g\2`]
+// Arguments are slices of parsed line, only quoted ones with escapes are
+// unescaped into `arena` (so they live until it's reset)
 
 typedef struct {
     StrSlice_t slice;
+    Arena_t* arena;
 } ParseArgs_t;
 
-ParseArgs_t ParseArgs_new(StrSlice_t slice) {
-    ParseArgs_t res = { slice };
+ParseArgs_t ParseArgs_new(StrSlice_t slice, Arena_t* arena) {
+    ParseArgs_t res = { slice, arena };
     return res;
 }
 
-IterRes ParseArgs_next(ParseArgs_t* self, String_t* res) {
+IterRes ParseArgs_next(ParseArgs_t* self, StrSlice_t* res) {
     // skip all spaces
-    while (*self->slice.str == ' ' && self->slice.size > 0) {
+    while (self->slice.size > 0 && *self->slice.str == ' ') {
         ++self->slice.str;
         --self->slice.size;
     }
     if (self->slice.size == 0)
         return IterEnd;
-    StrSlice_t part;
-    switch (*self->slice.str) {
-        case '"':
-            res->size = 0;
-            part.str = ++self->slice.str;
-            --self->slice.size;
-            for (; self->slice.size > 0; ++self->slice.str, --self->slice.size) {
-                switch (*self->slice.str) {
-                    case '"':
-                        part.size = self->slice.str - part.str;
-                        String_extend_with_StrSlice(res, part);
-                        ++self->slice.str;
-                        --self->slice.size;
-                        return IterOk;
-                    case '\\':
-                        part.size = self->slice.str - part.str;
-                        String_extend_with_StrSlice(res, part);
-                        ++self->slice.str;
-                        --self->slice.size;
-                        part.str = self->slice.str;
-                        switch (*self->slice.str) {
-                            case '\\':
-                            case '"':
-                                break;
-                            default:
-                                ERR("Something aside from '\"' or '\\' appeared after '\\'");
-                                return IterTotalErr;
-                        }
-                }
-            }
+    const char* str = self->slice.str;
+    size_t size = self->slice.size;
+    if (*str != '"') {
+        size_t len = 0;
+        while (len < size && str[len] != ' ' && str[len] != '"')
+            ++len;
+        *res = StrSlice_new(str, len);
+        // separator goes with argument
+        if (len < size)
+            ++len;
+        self->slice = StrSlice_new(str + len, size - len);
+        return IterOk;
+    }
+
+    ++str;
+    --size;
+    size_t len = 0;
+    size_t escapes = 0;
+    for (; len < size && str[len] != '"'; ++len) {
+        if (str[len] != '\\')
+            continue;
+        if (len + 1 == size)
             return IterTotalErr;
-        default:
-            part.str = self->slice.str;
-            while (
-                self->slice.size > 0
-                && *self->slice.str != ' '
-                && *self->slice.str != '"'
-            ) {
-                ++self->slice.str;
-                --self->slice.size;
-            }
-            part.size = self->slice.str - part.str;
-            if (self->slice.size > 0 && (*self->slice.str == ' ' || *self->slice.str == '"')) {
-                ++self->slice.str;
-                --self->slice.size;
-            }
-            StrSlice_to_String(part, res);
-            return IterOk;
+        if (str[len + 1] != '\\' && str[len + 1] != '"') {
+            ERR("Something aside from '\"' or '\\' appeared after '\\'");
+            return IterTotalErr;
+        }
+        ++escapes;
+        ++len;
+    }
+    if (len == size)
+        return IterTotalErr;
+    if (escapes == 0) {
+        *res = StrSlice_new(str, len);
+    } else {
+        char* unescaped = Arena_alloc(self->arena, len - escapes);
+        size_t unescaped_size = 0;
+        for (size_t i = 0; i < len; ++i) {
+            if (str[i] == '\\')
+                ++i;
+            unescaped[unescaped_size++] = str[i];
+        }
+        *res = StrSlice_new(unescaped, unescaped_size);
     }
+    self->slice = StrSlice_new(str + len + 1, size - len - 1);
+    return IterOk;
 }
 
 #endif
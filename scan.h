@@ -0,0 +1,245 @@
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+// Full-scan filter over raw fixed-width records: predicate is tested
+// against field bytes at fixed offset of every row, nothing is copied
+// or rstripped. Kernels exist in scalar, SSE2 and AVX2 flavours, the
+// best one supported by CPU is picked on first use (range test is two
+// memcmp's, which libc vectorizes anyway). Kernels don't look at alive
+// flag (its place depends on format of table), caller does.
+
+// Rows are processed (and their hits reported) in blocks of this size
+#define SCAN_BLOCK 4096
+
+typedef enum { ScanEq, ScanSubstr, ScanRange } ScanOp_t;
+
+typedef struct {
+    ScanOp_t op;
+    // position and width of field inside row
+    size_t offset;
+    size_t width;
+    // ScanEq: value padded with spaces to `width` bytes (or prefix of
+    // field, then `width` is its size);
+    // ScanSubstr: substring itself;
+    // ScanRange: lower bound padded to `width` bytes
+    const char* needle;
+    size_t needle_size;
+    // ScanRange: upper bound padded to `width` bytes (included) and
+    // 1 if lower bound is excluded, 0 otherwise
+    const char* upper;
+    int lower_cmp;
+} ScanPred_t;
+
+// Tests rows `base + i * stride` for i in [0, rows) (rows <= SCAN_BLOCK),
+// writes indices of matching rows into `hits`, returns their number
+typedef size_t (*ScanKernel_t)(const char* base, size_t rows, size_t stride, const ScanPred_t* pred, uint32_t* hits);
+
+// Match of substring (ending at `end` > 0) must lie inside value, not
+// reach into padding: some byte at `end - 1` or later is not padding
+bool scan_in_value(const char* field, size_t width, size_t end) {
+    for (size_t i = width; i-- > end - 1;)
+        if (field[i] != ' ')
+            return true;
+    return false;
+}
+
+bool scan_substr_at(const char* field, size_t width, size_t pos, const ScanPred_t* pred) {
+    return
+        memcmp(field + pos, pred->needle, pred->needle_size) == 0
+        && scan_in_value(field, width, pos + pred->needle_size);
+}
+
+size_t scan_eq_scalar(const char* base, size_t rows, size_t stride, const ScanPred_t* pred, uint32_t* hits) {
+    size_t found = 0;
+    for (size_t i = 0; i < rows; ++i) {
+        const char* row = base + i * stride;
+        if (memcmp(row + pred->offset, pred->needle, pred->width) == 0)
+            hits[found++] = i;
+    }
+    return found;
+}
+
+size_t scan_substr_scalar(const char* base, size_t rows, size_t stride, const ScanPred_t* pred, uint32_t* hits) {
+    size_t found = 0;
+    size_t positions = pred->width - pred->needle_size + 1;
+    for (size_t i = 0; i < rows; ++i) {
+        const char* field = base + i * stride + pred->offset;
+        for (size_t pos = 0; pos < positions; ++pos)
+            if (field[pos] == pred->needle[0] && scan_substr_at(field, pred->width, pos, pred)) {
+                hits[found++] = i;
+                break;
+            }
+    }
+    return found;
+}
+
+size_t scan_range_scalar(const char* base, size_t rows, size_t stride, const ScanPred_t* pred, uint32_t* hits) {
+    size_t found = 0;
+    for (size_t i = 0; i < rows; ++i) {
+        const char* field = base + i * stride + pred->offset;
+        if (
+            memcmp(field, pred->needle, pred->width) >= pred->lower_cmp
+            && memcmp(field, pred->upper, pred->width) <= 0
+        )
+            hits[found++] = i;
+    }
+    return found;
+}
+
+#ifdef SCAN_X86
+
+size_t scan_eq_sse2(const char* base, size_t rows, size_t stride, const ScanPred_t* pred, uint32_t* hits) {
+    size_t found = 0;
+    size_t width = pred->width;
+    for (size_t i = 0; i < rows; ++i) {
+        const char* field = base + i * stride + pred->offset;
+        size_t pos = 0;
+        bool eq = true;
+        for (; eq && pos + 16 <= width; pos += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (field + pos));
+            __m128i b = _mm_loadu_si128((const __m128i*) (pred->needle + pos));
+            eq = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) == 0xFFFF;
+        }
+        if (eq && (pos >= width || memcmp(field + pos, pred->needle + pos, width - pos) == 0))
+            hits[found++] = i;
+    }
+    return found;
+}
+
+// First and last byte of needle are compared at 16 positions at once,
+// only candidates passing both are checked with memcmp
+size_t scan_substr_sse2(const char* base, size_t rows, size_t stride, const ScanPred_t* pred, uint32_t* hits) {
+    size_t found = 0;
+    size_t n = pred->needle_size;
+    size_t positions = pred->width - n + 1;
+    __m128i first = _mm_set1_epi8(pred->needle[0]);
+    __m128i last = _mm_set1_epi8(pred->needle[n - 1]);
+    for (size_t i = 0; i < rows; ++i) {
+        const char* field = base + i * stride + pred->offset;
+        bool match = false;
+        size_t pos = 0;
+        // both loads stay inside field: pos + n - 1 + 16 <= width
+        for (; !match && pos + 16 <= positions; pos += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (field + pos));
+            __m128i b = _mm_loadu_si128((const __m128i*) (field + pos + n - 1));
+            unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+                _mm_cmpeq_epi8(a, first),
+                _mm_cmpeq_epi8(b, last)
+            ));
+            for (; !match && mask != 0; mask &= mask - 1)
+                match = scan_substr_at(field, pred->width, pos + __builtin_ctz(mask), pred);
+        }
+        for (; !match && pos < positions; ++pos)
+            match = field[pos] == pred->needle[0] && scan_substr_at(field, pred->width, pos, pred);
+        if (match)
+            hits[found++] = i;
+    }
+    return found;
+}
+
+__attribute__((target("avx2")))
+size_t scan_eq_avx2(const char* base, size_t rows, size_t stride, const ScanPred_t* pred, uint32_t* hits) {
+    size_t found = 0;
+    size_t width = pred->width;
+    for (size_t i = 0; i < rows; ++i) {
+        const char* field = base + i * stride + pred->offset;
+        size_t pos = 0;
+        bool eq = true;
+        for (; eq && pos + 32 <= width; pos += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i*) (field + pos));
+            __m256i b = _mm256_loadu_si256((const __m256i*) (pred->needle + pos));
+            eq = (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) == 0xFFFFFFFFu;
+        }
+        if (eq && pos + 16 <= width) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (field + pos));
+            __m128i b = _mm_loadu_si128((const __m128i*) (pred->needle + pos));
+            eq = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) == 0xFFFF;
+            pos += 16;
+        }
+        if (eq && (pos >= width || memcmp(field + pos, pred->needle + pos, width - pos) == 0))
+            hits[found++] = i;
+    }
+    return found;
+}
+
+__attribute__((target("avx2")))
+size_t scan_substr_avx2(const char* base, size_t rows, size_t stride, const ScanPred_t* pred, uint32_t* hits) {
+    size_t found = 0;
+    size_t n = pred->needle_size;
+    size_t positions = pred->width - n + 1;
+    __m256i first = _mm256_set1_epi8(pred->needle[0]);
+    __m256i last = _mm256_set1_epi8(pred->needle[n - 1]);
+    for (size_t i = 0; i < rows; ++i) {
+        const char* field = base + i * stride + pred->offset;
+        bool match = false;
+        size_t pos = 0;
+        for (; !match && pos + 32 <= positions; pos += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i*) (field + pos));
+            __m256i b = _mm256_loadu_si256((const __m256i*) (field + pos + n - 1));
+            unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(
+                _mm256_cmpeq_epi8(a, first),
+                _mm256_cmpeq_epi8(b, last)
+            ));
+            for (; !match && mask != 0; mask &= mask - 1)
+                match = scan_substr_at(field, pred->width, pos + __builtin_ctz(mask), pred);
+        }
+        for (; !match && pos < positions; ++pos)
+            match = field[pos] == pred->needle[0] && scan_substr_at(field, pred->width, pos, pred);
+        if (match)
+            hits[found++] = i;
+    }
+    return found;
+}
+
+#endif
+
+typedef enum { ScanScalar, ScanSSE2, ScanAVX2 } ScanIsa_t;
+
+const char* const scan_isa_names[] = { "scalar", "sse2", "avx2" };
+
+static ScanIsa_t scan_isa_picked = ScanScalar;
+static pthread_once_t scan_isa_once = PTHREAD_ONCE_INIT;
+
+void scan_isa_pick(void) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        scan_isa_picked = ScanSSE2;
+    if (__builtin_cpu_supports("avx2"))
+        scan_isa_picked = ScanAVX2;
+#endif
+}
+
+// Workers of parallel scan may be the first to ask
+ScanIsa_t scan_isa(void) {
+    pthread_once(&scan_isa_once, scan_isa_pick);
+    return scan_isa_picked;
+}
+
+ScanKernel_t scan_kernel(ScanOp_t op) {
+    if (op == ScanRange)
+        return scan_range_scalar;
+    switch (scan_isa()) {
+#ifdef SCAN_X86
+        case ScanAVX2:
+            return op == ScanEq ? scan_eq_avx2 : scan_substr_avx2;
+        case ScanSSE2:
+            return op == ScanEq ? scan_eq_sse2 : scan_substr_sse2;
+#endif
+        default:
+            return op == ScanEq ? scan_eq_scalar : scan_substr_scalar;
+    }
+}
+
+#endif
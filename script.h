@@ -0,0 +1,84 @@
+#ifndef __SCRIPT_H__
+#define __SCRIPT_H__
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "my_string.h"
+#include "utils.h"
+#include "vector.h"
+
+// Batch mode: whole script is read at once and split into command lines
+// up front, so that they are run back to back, without prompts and with
+// output going through large buffer
+
+// stdout buffer of batch mode
+#define SCRIPT_OUTPUT_BUFFER ((size_t) 1 << 20)
+#define SCRIPT_READ_SIZE ((size_t) 1 << 20)
+
+typedef struct {
+    String_t text;
+    // StrSlice_t's pointing into `text`: non-empty lines without \r\n
+    Vector_t lines;
+} Script_t;
+
+Script_t Script_new(void) {
+    Script_t res = { String_new(), Vector_new(sizeof(StrSlice_t), default_vector_destructor) };
+    return res;
+}
+
+// Reads script from `fd` till EOF. Returns false if it can't be read
+bool Script_read(Script_t* self, int fd) {
+    struct stat st;
+    size_t capacity = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ? (size_t) st.st_size + 1 : SCRIPT_READ_SIZE;
+    self->text = String_reserve(capacity);
+    for (;;) {
+        if (self->text.size == self->text.capacity) {
+            self->text.capacity *= 2;
+            self->text.str = realloc(self->text.str, self->text.capacity);
+            ANZ(self->text.str, "Allocation failed");
+        }
+        ssize_t res = read(fd, self->text.str + self->text.size, self->text.capacity - self->text.size);
+        if (res == -1 && errno == EINTR)
+            continue;
+        if (res == -1)
+            return false;
+        if (res == 0)
+            break;
+        self->text.size += res;
+    }
+
+    const char* end = self->text.str + self->text.size;
+    size_t lines_num = 1;
+    for (const char* pos = self->text.str; (pos = memchr(pos, '\n', end - pos)) != NULL; ++pos)
+        ++lines_num;
+    Vector_resize(&self->lines, lines_num);
+    for (const char* pos = self->text.str; pos < end;) {
+        const char* eol = memchr(pos, '\n', end - pos);
+        if (eol == NULL)
+            eol = end;
+        StrSlice_t line = StrSlice_new(pos, eol - pos);
+        if (line.size > 0 && line.str[line.size - 1] == '\r')
+            --line.size;
+        if (line.size > 0)
+            Vector_push(&self->lines, &line);
+        pos = eol + 1;
+    }
+    return true;
+}
+
+StrSlice_t Script_line(Script_t* self, size_t idx) {
+    return *(StrSlice_t*) Vector_index(&self->lines, idx);
+}
+
+void Script_drop(Script_t* self) {
+    Vector_drop(&self->lines);
+    String_drop(&self->text);
+}
+
+#endif
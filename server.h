@@ -0,0 +1,380 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "database.h"
+#include "fs_fallible.h"
+#include "handlers.h"
+#include "my_string.h"
+#include "parse_args.h"
+#include "utils.h"
+
+// Daemon mode: table stays open (indexes and page cache warm) and
+// commands of `handlers[]` are served over Unix domain socket by single
+// threaded epoll loop, so commands of all clients are run one at a time,
+// just like typed into shell. Request is command line ending with \n,
+// response is `<size>\n` followed by `<size>` bytes printed by command
+// (stdout and stderr interleaved, as shell shows them). Clients may
+// pipeline requests: every complete line received is run in order and
+// their responses go out with single write. `exit` closes connection,
+// SIGINT/SIGTERM stop server (table is closed cleanly)
+
+#define SERVER_BACKLOG 128
+#define SERVER_EVENTS 64
+#define SERVER_READ_SIZE ((size_t) 64 << 10)
+// Connection isn't read (so its pipelined commands wait) while this much
+// of its responses is unsent; it's dropped if its request line is longer
+#define SERVER_OUT_LIMIT ((size_t) 4 << 20)
+
+typedef struct Connection {
+    int fd;
+    String_t in;
+    // bytes of `in` already run
+    size_t in_done;
+    String_t out;
+    size_t out_sent;
+    // events it's registered in epoll with
+    uint32_t events;
+    // peer won't send anything more
+    bool eof;
+    // `exit` was run: close once `out` is sent
+    bool closing;
+    struct Connection* prev;
+    struct Connection* next;
+} Connection_t;
+
+typedef struct {
+    char* path;
+    int epoll_fd;
+    int listen_fd;
+    int signal_fd;
+    Database_t* database;
+    Connection_t* connections;
+    // output of command being run is captured here
+    FILE* capture;
+    char* captured;
+    size_t captured_size;
+    // arguments of command being run
+    Arena_t arena;
+} Server_t;
+
+void Connection_close(Server_t* server, Connection_t* self) {
+    close(self->fd);
+    if (self->prev != NULL)
+        self->prev->next = self->next;
+    else
+        server->connections = self->next;
+    if (self->next != NULL)
+        self->next->prev = self->prev;
+    String_drop(&self->in);
+    String_drop(&self->out);
+    free(self);
+}
+
+bool Connection_has_line(const Connection_t* self) {
+    return memchr(self->in.str + self->in_done, '\n', self->in.size - self->in_done) != NULL;
+}
+
+// Reads what peer has sent. Returns false if connection is broken
+bool Connection_read(Connection_t* self) {
+    if (self->in.capacity - self->in.size < SERVER_READ_SIZE) {
+        self->in.capacity = self->in.size + SERVER_READ_SIZE;
+        self->in.str = realloc(self->in.str, self->in.capacity);
+        ANZ(self->in.str, "Allocation failed");
+    }
+    ssize_t res = read(self->fd, self->in.str + self->in.size, SERVER_READ_SIZE);
+    if (res == -1)
+        return errno == EAGAIN || errno == EINTR;
+    if (res == 0)
+        self->eof = true;
+    self->in.size += res;
+    return self->in.size - self->in_done <= SERVER_OUT_LIMIT || Connection_has_line(self);
+}
+
+// Sends as much of pending output as socket takes. Returns false if
+// connection is broken
+bool Connection_flush(Connection_t* self) {
+    while (self->out_sent < self->out.size) {
+        ssize_t res = send(self->fd, self->out.str + self->out_sent, self->out.size - self->out_sent, MSG_NOSIGNAL);
+        if (res == -1) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN;
+        }
+        self->out_sent += res;
+    }
+    self->out.size = 0;
+    self->out_sent = 0;
+    return true;
+}
+
+// Runs `line` as shell would, appending framed response to `conn->out`
+enum Flow Server_run(Server_t* self, Connection_t* conn, StrSlice_t line) {
+    FILE* out = stdout;
+    FILE* err = stderr;
+    rewind(self->capture);
+    stdout = stderr = self->capture;
+    enum Flow flow = run_command(line, self->database, &self->arena, true, true);
+    fflush_(self->capture);
+    stdout = out;
+    stderr = err;
+    char header[24];
+    String_extend_with_StrSlice(&conn->out, StrSlice_new(header, snprintf(header, sizeof(header), "%zu\n", self->captured_size)));
+    String_extend_with_StrSlice(&conn->out, StrSlice_new(self->captured, self->captured_size));
+    return flow;
+}
+
+// Runs complete request lines of `conn` until its output backs up
+void Server_serve(Server_t* self, Connection_t* conn) {
+    while (!conn->closing && conn->out.size - conn->out_sent < SERVER_OUT_LIMIT) {
+        char* begin = conn->in.str + conn->in_done;
+        char* end = memchr(begin, '\n', conn->in.size - conn->in_done);
+        if (end == NULL) {
+            // last line may be unterminated
+            if (!conn->eof || conn->in_done == conn->in.size)
+                break;
+            end = conn->in.str + conn->in.size;
+        }
+        conn->in_done += end - begin + (end != conn->in.str + conn->in.size);
+        size_t size = end - begin;
+        if (size > 0 && begin[size - 1] == '\r')
+            --size;
+        if (Server_run(self, conn, StrSlice_new(begin, size)) == FlowExit)
+            conn->closing = true;
+    }
+    memmove(conn->in.str, conn->in.str + conn->in_done, conn->in.size - conn->in_done);
+    conn->in.size -= conn->in_done;
+    conn->in_done = 0;
+}
+
+void Server_handle(Server_t* self, Connection_t* conn, uint32_t events) {
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !conn->eof && !Connection_read(conn)) {
+        Connection_close(self, conn);
+        return;
+    }
+    for (;;) {
+        Server_serve(self, conn);
+        if (!Connection_flush(conn)) {
+            Connection_close(self, conn);
+            return;
+        }
+        if (conn->out.size != 0 || conn->closing || !Connection_has_line(conn))
+            break;
+    }
+    if (conn->out.size == 0 && (conn->closing || conn->eof)) {
+        Connection_close(self, conn);
+        return;
+    }
+    uint32_t wanted = conn->out.size != 0 ? EPOLLOUT : 0;
+    if (!conn->eof && !conn->closing && conn->out.size - conn->out_sent < SERVER_OUT_LIMIT)
+        wanted |= EPOLLIN;
+    if (wanted != conn->events) {
+        struct epoll_event event = { wanted, { .ptr = conn } };
+        if (epoll_ctl(self->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event)) { FATAL("epoll_ctl() != 0"); }
+        conn->events = wanted;
+    }
+}
+
+void Server_accept(Server_t* self) {
+    for (;;) {
+        int fd = accept(self->listen_fd, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN)
+                perror("WARN: accept()");
+            return;
+        }
+        if (fcntl(fd, F_SETFL, O_NONBLOCK) || fcntl(fd, F_SETFD, FD_CLOEXEC)) { FATAL("fcntl() != 0"); }
+        Connection_t* conn = malloc(sizeof(Connection_t));
+        ANZ(conn, "Allocation failed");
+        Connection_t init = { fd, String_new(), 0, String_new(), 0, EPOLLIN, false, false, NULL, self->connections };
+        *conn = init;
+        if (self->connections != NULL)
+            self->connections->prev = conn;
+        self->connections = conn;
+        struct epoll_event event = { EPOLLIN, { .ptr = conn } };
+        if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, fd, &event)) { FATAL("epoll_ctl() != 0"); }
+    }
+}
+
+int server_listen(const char* path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: socket path is longer than %zu bytes\n", sizeof(addr.sun_path) - 1);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) { FATAL("socket() failed"); }
+    int bound = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+    if (bound && errno == EADDRINUSE) {
+        // socket left by server that is gone is replaced, live one isn't
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe == -1) { FATAL("socket() failed"); }
+        bool alive = connect(probe, (struct sockaddr*) &addr, sizeof(addr)) == 0;
+        close(probe);
+        if (alive) {
+            fprintf(stderr, "ERROR: `%s` is already served by another process\n", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+        bound = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+    }
+    if (bound || listen(fd, SERVER_BACKLOG)) {
+        fprintf(stderr, "ERROR: can't listen on `%s`: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Starts listening on `path`. Returns false (and complains) on failure
+bool Server_open(Server_t* self, const char* path, Database_t* database) {
+    self->listen_fd = server_listen(path);
+    if (self->listen_fd == -1)
+        return false;
+    self->path = strdup(path);
+    ANZ(self->path, "Allocation failed");
+    self->database = database;
+    self->connections = NULL;
+    self->arena = Arena_new();
+    self->captured = NULL;
+    self->capture = open_memstream(&self->captured, &self->captured_size);
+    ANZ(self->capture, "open_memstream() failed");
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &signals, NULL)) { FATAL("sigprocmask() != 0"); }
+    self->signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (self->signal_fd == -1) { FATAL("signalfd() failed"); }
+
+    self->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (self->epoll_fd == -1) { FATAL("epoll_create1() failed"); }
+    struct epoll_event listen_event = { EPOLLIN, { .ptr = &self->listen_fd } };
+    struct epoll_event signal_event = { EPOLLIN, { .ptr = &self->signal_fd } };
+    if (
+        epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, self->listen_fd, &listen_event)
+        || epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, self->signal_fd, &signal_event)
+    ) { FATAL("epoll_ctl() != 0"); }
+    return true;
+}
+
+// Serves clients until SIGINT or SIGTERM
+void Server_loop(Server_t* self) {
+    printf("Serving on `%s`\n", self->path);
+    fflush_(stdout);
+    struct epoll_event events[SERVER_EVENTS];
+    for (;;) {
+        int ready = epoll_wait(self->epoll_fd, events, SERVER_EVENTS, -1);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            FATAL("epoll_wait() failed");
+        }
+        for (int i = 0; i < ready; ++i) {
+            if (events[i].data.ptr == &self->signal_fd) {
+                puts("Stopping server");
+                return;
+            }
+            if (events[i].data.ptr == &self->listen_fd)
+                Server_accept(self);
+            else
+                Server_handle(self, events[i].data.ptr, events[i].events);
+        }
+    }
+}
+
+void Server_close(Server_t* self) {
+    while (self->connections != NULL)
+        Connection_close(self, self->connections);
+    close(self->epoll_fd);
+    close(self->signal_fd);
+    close(self->listen_fd);
+    unlink(self->path);
+    fclose(self->capture);
+    free(self->captured);
+    free(self->path);
+    Arena_drop(&self->arena);
+}
+
+// Shell talking to server on `path`: lines of stdin are sent one by one
+// and responses printed. Returns exit status
+int Client_run(const char* path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: socket path is longer than %zu bytes\n", sizeof(addr.sun_path) - 1);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) { FATAL("socket() failed"); }
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr))) {
+        fprintf(stderr, "ERROR: can't connect to `%s`: %s\n", path, strerror(errno));
+        close(fd);
+        return 1;
+    }
+    FILE* responses = fdopen(fd, "r");
+    ANZ(responses, "fdopen() failed");
+    int ret_stat = 0;
+    String_t line = String_new();
+    Arena_t arena = Arena_new();
+    String_t response = String_new();
+    for (;;) {
+        fputs("$ ", stdout);
+        fflush(stdout);
+        if (String_getline(&line, stdin) == -1) {
+            puts("^D");
+            break;
+        }
+        if (line.str[line.size - 1] != '\n')
+            String_extend_with_StrSlice(&line, StrSlice_new("\n", 1));
+        write_all(fd, line.str, line.size);
+        size_t size;
+        if (String_getline(&response, responses) == -1 || sscanf(response.str, "%zu", &size) != 1) {
+            ERR("Server closed connection");
+            ret_stat = 1;
+            break;
+        }
+        if (response.capacity < size) {
+            response.str = realloc(response.str, size);
+            ANZ(response.str, "Allocation failed");
+            response.capacity = size;
+        }
+        if (fread(response.str, 1, size, responses) != size) {
+            ERR("Server closed connection");
+            ret_stat = 1;
+            break;
+        }
+        StrSlice_fput(StrSlice_new(response.str, size), stdout);
+        ParseArgs_t it = ParseArgs_new(StrSlice_new(line.str, line.size - 1), &arena);
+        StrSlice_t word;
+        if (ParseArgs_next(&it, &word) == IterOk && StrSlice_eq_str(word, "exit"))
+            break;
+        Arena_reset(&arena);
+    }
+    fclose(responses);
+    String_drop(&line);
+    Arena_drop(&arena);
+    String_drop(&response);
+    return ret_stat;
+}
+
+#endif
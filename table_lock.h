@@ -0,0 +1,193 @@
+#ifndef __TABLE_LOCK_H__
+#define __TABLE_LOCK_H__
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fs_fallible.h"
+#include "utils.h"
+
+// Coordination of processes having the same table open, through page
+// mapped from `<filename>.lock`. Whoever holds flock on that file is the
+// only writer; everyone else is reader. Writer appends rows past
+// `rows_num` and publishes new count once they're complete, so reader
+// scanning first `rows_num` rows (read at scan start) never sees half of
+// appended row. Rows rewritten in place (slot of deleted row reused) are
+// guarded by seqlock `seq`: it is odd while rewrite is in progress, and
+// reader retries copy of rows if it changed meanwhile. Lock is released
+// by kernel if writer dies, so next process to open table recovers it
+// (as does reader which finds rewrite left unfinished)
+
+#define TABLE_LOCK_SIZE ((size_t) 4096)
+// yields reader waits for rewrite to end before checking writer is alive
+#define TABLE_LOCK_SPINS 1024
+
+typedef struct {
+    char magic[8];
+    // of current writer, informational only
+    uint64_t writer_pid;
+    uint64_t seq;
+    // rows readers may look at and how many of them are alive
+    uint64_t rows_num;
+    uint64_t alive_num;
+    // bumped when table file is replaced (`vacuum`, `migrate`), so that
+    // readers reopen it
+    uint64_t generation;
+} TableLockPage_t;
+
+typedef struct {
+    int fd;
+    TableLockPage_t* page;
+    bool writer;
+    // `page->generation` when table was opened
+    uint64_t generation;
+} TableLock_t;
+
+static const char TABLE_LOCK_MAGIC[8] = "09LOCK";
+
+void tablelock_own(TableLock_t* self) {
+    self->writer = true;
+    memcpy(self->page->magic, TABLE_LOCK_MAGIC, sizeof(TABLE_LOCK_MAGIC));
+    self->page->writer_pid = getpid();
+    // rewrite interrupted by crash leaves it odd
+    if (self->page->seq % 2 != 0)
+        ++self->page->seq;
+}
+
+// Takes writer lock if it's free (reader, whose writer has gone, becomes
+// writer). Returns true if we're writer
+bool TableLock_take(TableLock_t* self) {
+    if (self->writer)
+        return true;
+    if (flock(self->fd, LOCK_EX | LOCK_NB) != 0)
+        return false;
+    tablelock_own(self);
+    return true;
+}
+
+// Opens (creating if needed) lock file at `path` and takes writer lock
+// if it's free. Returns false if lock file can't be used
+bool TableLock_open(TableLock_t* self, const char* path) {
+    self->page = NULL;
+    self->writer = false;
+    self->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (self->fd == -1)
+        return false;
+    bool writer = flock(self->fd, LOCK_EX | LOCK_NB) == 0;
+    struct stat st;
+    if (fstat(self->fd, &st)) { FATAL("fstat() != 0"); }
+    // only writer initializes page, reader can't use it before
+    if ((size_t) st.st_size < TABLE_LOCK_SIZE) {
+        if (!writer) {
+            close(self->fd);
+            self->fd = -1;
+            return false;
+        }
+        ftruncate_(self->fd, TABLE_LOCK_SIZE);
+    }
+    self->page = mmap(NULL, TABLE_LOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
+    if (self->page == MAP_FAILED) { FATAL("mmap() failed"); }
+    if (writer)
+        tablelock_own(self);
+    self->generation = self->page->generation;
+    return true;
+}
+
+// Releases writer lock (if held)
+void TableLock_close(TableLock_t* self) {
+    if (self->fd == -1)
+        return;
+    if (self->writer)
+        self->page->writer_pid = 0;
+    munmap_(self->page, TABLE_LOCK_SIZE);
+    close(self->fd);
+    self->fd = -1;
+}
+
+// Pid of writer other than us, 0 if there is none (it may be gone)
+uint64_t TableLock_writer(const TableLock_t* self) {
+    return self->writer || self->page == NULL ? 0 : self->page->writer_pid;
+}
+
+void TableLock_publish(TableLock_t* self, size_t rows_num, size_t alive_num) {
+    if (!self->writer)
+        return;
+    __atomic_store_n(&self->page->alive_num, alive_num, __ATOMIC_RELAXED);
+    __atomic_store_n(&self->page->rows_num, rows_num, __ATOMIC_RELEASE);
+}
+
+// Called by writer once table file is replaced
+void TableLock_replaced(TableLock_t* self) {
+    self->generation = ++self->page->generation;
+}
+
+bool TableLock_stale(const TableLock_t* self) {
+    return __atomic_load_n(&self->page->generation, __ATOMIC_ACQUIRE) != self->generation;
+}
+
+size_t TableLock_rows(const TableLock_t* self) {
+    return __atomic_load_n(&self->page->rows_num, __ATOMIC_ACQUIRE);
+}
+
+// Writer brackets in-place rewrite of rows with these
+void TableLock_write_begin(TableLock_t* self) {
+    if (!self->writer)
+        return;
+    __atomic_store_n(&self->page->seq, self->page->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void TableLock_write_end(TableLock_t* self) {
+    if (!self->writer)
+        return;
+    __atomic_store_n(&self->page->seq, self->page->seq + 1, __ATOMIC_RELEASE);
+}
+
+// True if nobody holds writer lock, checked without taking it
+bool TableLock_orphaned(const TableLock_t* self) {
+    if (flock(self->fd, LOCK_SH | LOCK_NB) != 0)
+        return false;
+    flock(self->fd, LOCK_UN);
+    return true;
+}
+
+// True if writer died in the middle of rewrite: rows may be half-written
+// until someone takes writer lock and recovers table
+bool TableLock_crashed(const TableLock_t* self) {
+    if (self->writer || self->page == NULL)
+        return false;
+    return __atomic_load_n(&self->page->seq, __ATOMIC_ACQUIRE) % 2 != 0 && TableLock_orphaned(self);
+}
+
+// Reader copies rows between `TableLock_read_begin` and
+// `TableLock_read_retry`, and copies them again if the latter is true.
+// Returns false instead of waiting forever if table has crashed (see
+// `TableLock_crashed`)
+bool TableLock_read_begin(const TableLock_t* self, uint64_t* seq) {
+    *seq = 0;
+    if (self->writer || self->page == NULL)
+        return true;
+    for (size_t spins = 1; (*seq = __atomic_load_n(&self->page->seq, __ATOMIC_ACQUIRE)) % 2 != 0; ++spins) {
+        if (spins % TABLE_LOCK_SPINS == 0 && TableLock_orphaned(self))
+            return false;
+        sched_yield();
+    }
+    return true;
+}
+
+bool TableLock_read_retry(const TableLock_t* self, uint64_t seq) {
+    if (self->writer || self->page == NULL)
+        return false;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&self->page->seq, __ATOMIC_RELAXED) != seq;
+}
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef __TABLE_WRITER_H__
+#define __TABLE_WRITER_H__
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "database.h"
+#include "fs_fallible.h"
+#include "utils.h"
+
+// Streams rows into new table file (header first), laid out as in
+// `layout`. Rows are collected into big buffer which is written at once;
+// for binary table buffer always holds whole blocks, so bitmap of block
+// is complete when it's written
+typedef struct {
+    const Database_t* layout;
+    int fd;
+    char* buffer;
+    size_t capacity;
+    size_t size;
+    // Offset of bitmap of current block in buffer (binary table only)
+    size_t bitmap;
+    size_t rows;
+    size_t alive;
+} TableWriter_t;
+
+#define TABLE_WRITER_BUFFER_SIZE ((size_t) 8 << 20)
+
+// Opens `path` with `flags` (in addition to O_WRONLY | O_CREAT) and
+// writes header. Returns false if file can't be opened
+bool TableWriter_new(TableWriter_t* self, const Database_t* layout, const char* path, int flags) {
+    int fd = open(path, O_WRONLY | O_CREAT | flags, 0644);
+    if (fd == -1)
+        return false;
+    size_t unit = layout->format == FormatBinary ? Database_block_size(layout) : layout->row_size;
+    size_t capacity = (TABLE_WRITER_BUFFER_SIZE / unit + 1) * unit;
+    TableWriter_t res = { layout, fd, malloc(capacity), capacity, 0, 0, 0, 0 };
+    ANZ(res.buffer, "Allocation failed");
+    *self = res;
+    DatabaseHeader_t header;
+    DatabaseHeader_init(&header, layout->columns, layout->col_num, layout->format);
+    write_all(fd, (const char*) &header, sizeof(header));
+    return true;
+}
+
+void TableWriter_flush(TableWriter_t* self) {
+    write_all(self->fd, self->buffer, self->size);
+    self->size = 0;
+}
+
+// Place for next row in buffer
+char* TableWriter_slot(TableWriter_t* self) {
+    const Database_t* layout = self->layout;
+    bool block_start = layout->format == FormatBinary && self->rows % DATABASE_BLOCK_ROWS == 0;
+    if (self->size + layout->row_size + (block_start ? DATABASE_LINE_SIZE : 0) > self->capacity)
+        TableWriter_flush(self);
+    if (block_start) {
+        self->bitmap = self->size;
+        memset(self->buffer + self->size, 0, DATABASE_LINE_SIZE);
+        self->size += DATABASE_LINE_SIZE;
+    }
+    char* res = self->buffer + self->size;
+    self->size += layout->row_size;
+    ++self->rows;
+    return res;
+}
+
+// Marks row just put into `slot` as alive or deleted
+void TableWriter_set_alive(TableWriter_t* self, char* slot, bool alive) {
+    self->alive += alive;
+    if (self->layout->format == FormatText) {
+        slot[0] = alive ? '+' : '-';
+    } else if (alive) {
+        size_t idx = (self->rows - 1) % DATABASE_BLOCK_ROWS;
+        uint64_t* bitmap = (uint64_t*) (self->buffer + self->bitmap);
+        bitmap[idx / 64] |= (uint64_t) 1 << (idx % 64);
+    }
+}
+
+// Values must fit into columns of layout
+void TableWriter_push(TableWriter_t* self, const StrSlice_t* vals, bool alive) {
+    char* slot = TableWriter_slot(self);
+    Database_format_row(self->layout, vals, slot);
+    TableWriter_set_alive(self, slot, alive);
+}
+
+// Copies row of table with the same layout as is
+void TableWriter_push_raw(TableWriter_t* self, const char* line, bool alive) {
+    char* slot = TableWriter_slot(self);
+    memcpy(slot, line, self->layout->row_size);
+    TableWriter_set_alive(self, slot, alive);
+}
+
+// Writes the rest of rows, header with final counters, syncs and closes
+// file. Free list isn't saved, deleted rows are found on open
+void TableWriter_finish(TableWriter_t* self) {
+    TableWriter_flush(self);
+    DatabaseHeader_t header;
+    DatabaseHeader_init(&header, self->layout->columns, self->layout->col_num, self->layout->format);
+    header.rows_num = self->rows;
+    header.alive_num = self->alive;
+    header.free_num = self->rows - self->alive;
+    header.clean = 1;
+    pwrite_all(self->fd, (const char*) &header, sizeof(header), 0);
+    if (fsync(self->fd)) { FATAL("fsync() != 0"); }
+    close(self->fd);
+    free(self->buffer);
+}
+
+// Closes and removes unfinished file
+void TableWriter_abort(TableWriter_t* self, const char* path) {
+    close(self->fd);
+    free(self->buffer);
+    remove(path);
+}
+
+#endif
@@ -1,10 +1,19 @@
 #ifndef __UTILS_H__
 #define __UTILS_H__
 
+#include <time.h>
+
 #define ERR(err) fprintf(stderr, "ERROR (%s:%i): %s\n", __FILE__, __LINE__, err);
 #define FATAL(err) fprintf(stderr, "FATAL (%s:%i): %s\n", __FILE__, __LINE__, err); exit(1);
 
 // Assert Non Zero (for `malloc` output, for example)
 #define ANZ(expr, msg) if ((expr) == 0) { FATAL(msg); }
 
+// Seconds passed since `start` taken from CLOCK_MONOTONIC
+double seconds_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
 #endif
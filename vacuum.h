@@ -0,0 +1,158 @@
+#ifndef __VACUUM_H__
+#define __VACUUM_H__
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "database.h"
+#include "table_writer.h"
+#include "utils.h"
+
+// Translation table left by `vacuum --keep-remap` in `<filename>.remap`:
+// header followed by `rows_num` new indices (REMAP_DELETED for rows
+// that were removed), indexed by row index from before first vacuum
+
+#define REMAP_DELETED UINT64_MAX
+
+typedef struct {
+    char magic[8];
+    uint64_t rows_num;
+} RemapHeader_t;
+
+static const char REMAP_MAGIC[8] = "09REMAP";
+
+typedef enum { VacuumOk, VacuumBatching, VacuumIOErr } VacuumStatus_t;
+
+typedef enum { RemapOk, RemapDeleted, RemapOutOfBounds, RemapNoTable } RemapStatus_t;
+
+// Writes translation table `remap` (of `rows_num` entries), composing it
+// with already existing one, so that indices from before all vacuums
+// still resolve
+void Remap_save(const char* path, uint64_t* remap, size_t rows_num) {
+    FILE* old = fopen(path, "rb");
+    uint64_t* composed = NULL;
+    RemapHeader_t header;
+    if (old != NULL) {
+        if (
+            fread(&header, sizeof(header), 1, old) == 1
+            && memcmp(header.magic, REMAP_MAGIC, sizeof(REMAP_MAGIC)) == 0
+        ) {
+            composed = malloc(header.rows_num * sizeof(uint64_t) + 1);
+            ANZ(composed, "Allocation failed");
+            if (fread(composed, sizeof(uint64_t), header.rows_num, old) != header.rows_num) {
+                free(composed);
+                composed = NULL;
+            }
+        }
+        fclose(old);
+    }
+    if (composed != NULL) {
+        for (uint64_t i = 0; i < header.rows_num; ++i)
+            if (composed[i] != REMAP_DELETED)
+                composed[i] = composed[i] < rows_num ? remap[composed[i]] : REMAP_DELETED;
+        remap = composed;
+        rows_num = header.rows_num;
+    }
+
+    size_t tmp_size = strlen(path) + 5;
+    char tmp[tmp_size];
+    snprintf(tmp, tmp_size, "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        ERR("Can't write translation table");
+        free(composed);
+        return;
+    }
+    RemapHeader_t new_header = { {0}, rows_num };
+    memcpy(new_header.magic, REMAP_MAGIC, sizeof(REMAP_MAGIC));
+    write_all(fd, (const char*) &new_header, sizeof(new_header));
+    write_all(fd, (const char*) remap, rows_num * sizeof(uint64_t));
+    if (fsync(fd)) { FATAL("fsync() != 0"); }
+    close(fd);
+    if (rename(tmp, path)) {
+        ERR("Can't write translation table");
+    }
+    free(composed);
+}
+
+// Translates row index from before `vacuum`s into current one
+RemapStatus_t Remap_lookup(const char* path, size_t old_idx, size_t* new_idx) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return RemapNoTable;
+    RemapStatus_t res = RemapNoTable;
+    RemapHeader_t header;
+    uint64_t entry;
+    if (
+        pread(fd, &header, sizeof(header), 0) != sizeof(header)
+        || memcmp(header.magic, REMAP_MAGIC, sizeof(REMAP_MAGIC)) != 0
+    )
+        goto wipeout;
+    res = RemapOutOfBounds;
+    if (old_idx >= header.rows_num)
+        goto wipeout;
+    res = RemapNoTable;
+    if (pread(fd, &entry, sizeof(entry), sizeof(header) + old_idx * sizeof(entry)) != sizeof(entry))
+        goto wipeout;
+    res = entry == REMAP_DELETED ? RemapDeleted : RemapOk;
+    *new_idx = entry;
+
+    wipeout:
+    close(fd);
+    return res;
+}
+
+// Rewrites table without deleted rows: alive rows are streamed straight
+// from mapping into `<filename>.vacuum`, which is synced and renamed over
+// table. Database is reopened afterwards (indexes are rebuilt, free list
+// is empty). With `keep_remap` old -> new index translation is kept for
+// `remap`, otherwise any previous translation table is dropped.
+// Reports number of kept rows in `kept`
+VacuumStatus_t Database_vacuum(Database_t* self, bool keep_remap, size_t* kept) {
+    if (self->batching)
+        return VacuumBatching;
+    char* tmp_path = Database_sidecar(self, ".vacuum");
+    TableWriter_t writer;
+    if (!TableWriter_new(&writer, self, tmp_path, O_TRUNC)) {
+        free(tmp_path);
+        return VacuumIOErr;
+    }
+    uint64_t* remap = malloc(self->rows_num * sizeof(uint64_t) + 1);
+    ANZ(remap, "Allocation failed");
+    for (size_t idx = 0; idx < self->rows_num; ++idx) {
+        if (!Database_alive(self, idx)) {
+            remap[idx] = REMAP_DELETED;
+            Database_release_behind(self, idx);
+            continue;
+        }
+        remap[idx] = writer.rows;
+        TableWriter_push_raw(&writer, Database_row(self, idx), true);
+        Database_release_behind(self, idx);
+    }
+    *kept = writer.rows;
+    TableWriter_finish(&writer);
+
+    // log must not outlive table it was written for
+    Wal_sync(self->wal, true);
+    if (rename(tmp_path, self->filename)) { FATAL("Can't rename vacuumed table over old one"); }
+    fsync_parent(self->filename);
+    char* remap_path = Database_sidecar(self, ".remap");
+    if (keep_remap)
+        Remap_save(remap_path, remap, self->rows_num);
+    else
+        remove(remap_path);
+    Database_reopen(self);
+
+    free(remap);
+    free(tmp_path);
+    free(remap_path);
+    return VacuumOk;
+}
+
+#endif
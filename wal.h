@@ -0,0 +1,345 @@
+#ifndef __WAL_H__
+#define __WAL_H__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fs_fallible.h"
+#include "hash_index.h"
+#include "my_string.h"
+#include "utils.h"
+
+// Write-ahead log of in-place mutations (`add`, `update`, `delete`,
+// `resurrect`) in `<filename>.wal`. Record with new image of row is
+// queued first and only then table is changed through mapping; log stays
+// locked meanwhile, so flusher never takes record whose change isn't in
+// table yet. Background flusher writes queued records and syncs log once
+// per WAL_SYNC_OPS records or WAL_SYNC_MS after first of them, whichever
+// comes first, so one fsync covers whole group: crash loses at most that
+// much of latest changes (`Wal_sync` waits for them). Records are
+// physical and idempotent: replaying log of crashed session (in order)
+// over table restores every synced mutation, however much of it reached
+// table itself.
+// When log grows past WAL_CHECKPOINT_SIZE flusher checkpoints: starts
+// new log (old one is renamed to `<filename>.wal.old`), syncs table,
+// whose mapping already holds every change from old log, and removes
+// old log. Replay reads `.wal.old` (if crash hit checkpoint) then `.wal`
+
+#define WAL_SYNC_OPS 256
+#define WAL_SYNC_MS 10
+#define WAL_CHECKPOINT_SIZE ((size_t) 64 << 20)
+
+typedef struct {
+    char magic[8];
+    // row size of table log was written for, other logs are ignored
+    uint64_t row_size;
+} WalHeader_t;
+
+typedef struct {
+    // FNV-1a of rest of record (row included): torn tail of log, which
+    // was never synced, is cut off at first mismatch
+    uint64_t hash;
+    uint64_t idx;
+    // `row_size` if whole row follows, 0 if only alive flag changed
+    uint32_t size;
+    uint32_t alive;
+} WalRecord_t;
+
+static const char WAL_MAGIC[8] = "09WAL";
+
+typedef struct {
+    // current log
+    int fd;
+    char* path;
+    char* old_path;
+    // table is synced through it on checkpoint
+    int table_fd;
+    size_t row_size;
+    size_t log_size;
+
+    pthread_t flusher;
+    pthread_mutex_t lock;
+    // wakes flusher: first record queued, group full, sync requested
+    pthread_cond_t wake;
+    // signals that `synced` moved
+    pthread_cond_t done;
+    // Fields below are guarded by `lock`
+    // records not written to log yet
+    String_t pending;
+    size_t pending_ops;
+    struct timespec pending_since;
+    // numbers of records queued, synced and requested to be synced
+    uint64_t queued;
+    uint64_t synced;
+    uint64_t wanted;
+    bool checkpoint_wanted;
+    bool stop;
+} Wal_t;
+
+// Called for every intact record in order; `row` is NULL for records
+// changing only alive flag
+typedef void (*WalApply_t)(void* ctx, const WalRecord_t* record, const char* row);
+
+uint64_t WalRecord_hash(const char* record, size_t size) {
+    return StrSlice_hash(StrSlice_new(record + sizeof(uint64_t), size - sizeof(uint64_t)));
+}
+
+// Applies records of single log file, returns their number
+size_t wal_replay_file(const char* path, size_t row_size, WalApply_t apply, void* ctx) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return 0;
+    struct stat st;
+    if (fstat(fd, &st)) { FATAL("fstat() != 0"); }
+    size_t size = st.st_size;
+    size_t applied = 0;
+    if (size < sizeof(WalHeader_t))
+        goto wipeout;
+    char* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) { FATAL("mmap() failed"); }
+    madvise(map, size, MADV_SEQUENTIAL);
+    const WalHeader_t* header = (const WalHeader_t*) map;
+    if (memcmp(header->magic, WAL_MAGIC, sizeof(WAL_MAGIC)) != 0 || header->row_size != row_size) {
+        fprintf(stderr, "WARN: %s is not log of this table, ignored\n", path);
+        munmap_(map, size);
+        goto wipeout;
+    }
+    for (size_t pos = sizeof(WalHeader_t); pos + sizeof(WalRecord_t) <= size;) {
+        WalRecord_t record;
+        memcpy(&record, map + pos, sizeof(record));
+        size_t record_size = sizeof(record) + record.size;
+        if (
+            (record.size != 0 && record.size != row_size)
+            || pos + record_size > size
+            || WalRecord_hash(map + pos, record_size) != record.hash
+        )
+            break;
+        apply(ctx, &record, record.size != 0 ? map + pos + sizeof(record) : NULL);
+        ++applied;
+        pos += record_size;
+    }
+    munmap_(map, size);
+
+    wipeout:
+    close(fd);
+    return applied;
+}
+
+// Replays logs left at `path` by session which wasn't closed properly.
+// Logs stay in place until `Wal_open`, which must be called only after
+// applied changes are synced to table. Returns number of applied records
+size_t Wal_replay(const char* path, size_t row_size, WalApply_t apply, void* ctx) {
+    size_t old_size = strlen(path) + 5;
+    char old_path[old_size];
+    snprintf(old_path, old_size, "%s.old", path);
+    size_t applied = wal_replay_file(old_path, row_size, apply, ctx);
+    return applied + wal_replay_file(path, row_size, apply, ctx);
+}
+
+// Creates empty log at `self->path`, replacing existing one
+void wal_create(Wal_t* self) {
+    self->fd = open(self->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (self->fd == -1) { FATAL("Can't open write-ahead log"); }
+    WalHeader_t header = { {0}, self->row_size };
+    memcpy(header.magic, WAL_MAGIC, sizeof(WAL_MAGIC));
+    write_all(self->fd, (const char*) &header, sizeof(header));
+    if (fdatasync(self->fd)) { FATAL("fdatasync() != 0"); }
+    self->log_size = sizeof(header);
+}
+
+// Called by flusher only
+void wal_checkpoint(Wal_t* self) {
+    if (rename(self->path, self->old_path)) { FATAL("Can't rotate write-ahead log"); }
+    close(self->fd);
+    wal_create(self);
+    fsync_parent(self->path);
+    // Change of every record of old log was made in mapping before
+    // flusher took it, so table holds all of them once synced
+    if (fdatasync(self->table_fd)) { FATAL("fdatasync() != 0"); }
+    remove(self->old_path);
+}
+
+bool wal_due(const Wal_t* self) {
+    if (self->stop || self->checkpoint_wanted || self->wanted > self->synced)
+        return true;
+    if (self->pending_ops == 0)
+        return false;
+    if (self->pending_ops >= WAL_SYNC_OPS)
+        return true;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return
+        (now.tv_sec - self->pending_since.tv_sec) * 1000
+        + (now.tv_nsec - self->pending_since.tv_nsec) / 1000000 >= WAL_SYNC_MS;
+}
+
+void* wal_flusher(void* arg) {
+    Wal_t* self = arg;
+    String_t group = String_new();
+    pthread_mutex_lock(&self->lock);
+    for (;;) {
+        if (!wal_due(self)) {
+            if (self->pending_ops == 0) {
+                pthread_cond_wait(&self->wake, &self->lock);
+            } else {
+                struct timespec deadline = self->pending_since;
+                deadline.tv_nsec += WAL_SYNC_MS * 1000000L;
+                deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+                deadline.tv_nsec %= 1000000000L;
+                pthread_cond_timedwait(&self->wake, &self->lock, &deadline);
+            }
+            continue;
+        }
+        // Take whole group, so that new records are queued meanwhile
+        String_t taken = self->pending;
+        self->pending = group;
+        self->pending.size = 0;
+        group = taken;
+        self->pending_ops = 0;
+        uint64_t queued = self->queued;
+        bool checkpoint = self->checkpoint_wanted;
+        bool stop = self->stop;
+        pthread_mutex_unlock(&self->lock);
+
+        if (group.size != 0) {
+            write_all(self->fd, group.str, group.size);
+            if (fdatasync(self->fd)) { FATAL("fdatasync() != 0"); }
+            self->log_size += group.size;
+        }
+        if (checkpoint || self->log_size >= WAL_CHECKPOINT_SIZE)
+            wal_checkpoint(self);
+
+        pthread_mutex_lock(&self->lock);
+        self->synced = queued;
+        if (checkpoint)
+            self->checkpoint_wanted = false;
+        pthread_cond_broadcast(&self->done);
+        if (stop)
+            break;
+    }
+    pthread_mutex_unlock(&self->lock);
+    String_drop(&group);
+    return NULL;
+}
+
+// Starts new log at `path` for table open as `table_fd` (whose logs,
+// if any, are already replayed and synced) and its flusher.
+// Freed by `Wal_remove`
+Wal_t* Wal_open(const char* path, int table_fd, size_t row_size) {
+    Wal_t* self = malloc(sizeof(Wal_t));
+    ANZ(self, "Allocation failed");
+    self->path = strdup(path);
+    ANZ(self->path, "Allocation failed");
+    size_t old_size = strlen(path) + 5;
+    self->old_path = malloc(old_size);
+    ANZ(self->old_path, "Allocation failed");
+    snprintf(self->old_path, old_size, "%s.old", path);
+    self->table_fd = table_fd;
+    self->row_size = row_size;
+    wal_create(self);
+    fsync_parent(path);
+    remove(self->old_path);
+
+    self->pending = String_new();
+    self->pending_ops = 0;
+    self->queued = self->synced = self->wanted = 0;
+    self->checkpoint_wanted = self->stop = false;
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&self->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&self->done, NULL);
+    // signals are left to thread that opened log (server waits for them)
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (pthread_create(&self->flusher, NULL, wal_flusher, self)) { FATAL("pthread_create() failed"); }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return self;
+}
+
+// Queues record of row #idx: its new image (`row` may be NULL if only
+// alive flag changed). Change is made in table only after that, and log
+// stays locked until `Wal_applied` says it's done.
+// Table without log (`self` is NULL) is fine
+void Wal_append(Wal_t* self, size_t idx, const char* row, bool alive) {
+    if (self == NULL)
+        return;
+    WalRecord_t record = { 0, idx, row != NULL ? self->row_size : 0, alive };
+    pthread_mutex_lock(&self->lock);
+    size_t start = self->pending.size;
+    String_extend_with_StrSlice(&self->pending, StrSlice_new((const char*) &record, sizeof(record)));
+    if (row != NULL)
+        String_extend_with_StrSlice(&self->pending, StrSlice_new(row, self->row_size));
+    record.hash = WalRecord_hash(self->pending.str + start, self->pending.size - start);
+    memcpy(self->pending.str + start, &record.hash, sizeof(record.hash));
+    if (self->pending_ops++ == 0)
+        clock_gettime(CLOCK_MONOTONIC, &self->pending_since);
+    ++self->queued;
+    // flusher has to start its timer or group is full
+    if (self->pending_ops == 1 || self->pending_ops >= WAL_SYNC_OPS)
+        pthread_cond_signal(&self->wake);
+}
+
+// Called once change logged by `Wal_append` is made in table
+void Wal_applied(Wal_t* self) {
+    if (self == NULL)
+        return;
+    pthread_mutex_unlock(&self->lock);
+}
+
+// Waits until every queued record is synced (with `checkpoint` log is
+// also emptied, so that table alone holds all changes)
+void Wal_sync(Wal_t* self, bool checkpoint) {
+    if (self == NULL)
+        return;
+    pthread_mutex_lock(&self->lock);
+    uint64_t target = self->queued;
+    if (self->wanted < target)
+        self->wanted = target;
+    if (checkpoint)
+        self->checkpoint_wanted = true;
+    pthread_cond_signal(&self->wake);
+    while (self->synced < target || (checkpoint && self->checkpoint_wanted))
+        pthread_cond_wait(&self->done, &self->lock);
+    pthread_mutex_unlock(&self->lock);
+}
+
+// Syncs queued records and stops flusher. Log is kept: caller removes
+// it with `Wal_remove` once table is synced
+void Wal_close(Wal_t* self) {
+    pthread_mutex_lock(&self->lock);
+    self->stop = true;
+    pthread_cond_signal(&self->wake);
+    pthread_mutex_unlock(&self->lock);
+    pthread_join(self->flusher, NULL);
+    pthread_mutex_destroy(&self->lock);
+    pthread_cond_destroy(&self->wake);
+    pthread_cond_destroy(&self->done);
+    String_drop(&self->pending);
+    close(self->fd);
+}
+
+void Wal_remove(Wal_t* self) {
+    remove(self->path);
+    remove(self->old_path);
+    free(self->path);
+    free(self->old_path);
+    free(self);
+}
+
+#endif